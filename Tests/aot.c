@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Tests programs compiled ahead of time with cellatom's -c flag.  This is
+ * linked with the object file, runs the exported automaton on the grid in a
+ * grid file for the given number of generations, with truncated
+ * neighbourhoods, and prints the result in the same form as cellatom.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * The automaton that `cellatom -c` exports.
+ */
+void cellatom_automaton(int16_t *oldgrid, int16_t *newgrid,
+                        int64_t width, int64_t height,
+                        int64_t xStart, int64_t xEnd,
+                        int64_t yStart, int64_t yEnd);
+
+/**
+ * The header of a grid file, as in gridfile.hh.
+ */
+struct header
+{
+	char magic[8];
+	uint32_t version;
+	uint16_t cellSize;
+	uint16_t encoding;
+	int64_t width;
+	int64_t height;
+	uint64_t generation;
+	int16_t globals[10];
+	uint8_t padding[4];
+};
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s {grid file} {generations}\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	FILE *f = fopen(argv[1], "rb");
+	if (!f)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	struct header h;
+	if (fread(&h, sizeof(h), 1, f) != 1 || h.version != 2 ||
+	    h.cellSize != sizeof(int16_t))
+	{
+		fprintf(stderr, "%s is not a version 2 grid file\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	// The grids have a one-cell halo, which is never read with truncated
+	// neighbourhoods.
+	size_t cells = (size_t)(h.width + 2) * (size_t)(h.height + 2);
+	int16_t *grids[2];
+	grids[0] = calloc(cells, sizeof(int16_t));
+	grids[1] = calloc(cells, sizeof(int16_t));
+	if (fread(grids[0], sizeof(int16_t), cells, f) != cells)
+	{
+		fprintf(stderr, "%s is too short for its grid\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+	int generations = atoi(argv[2]);
+	for (int i=0 ; i<generations ; i++)
+	{
+		cellatom_automaton(grids[0], grids[1], h.width, h.height, 0, h.width,
+		                   0, h.height);
+		int16_t *tmp = grids[0];
+		grids[0] = grids[1];
+		grids[1] = tmp;
+	}
+	for (int64_t x=0 ; x<h.width ; x++)
+	{
+		for (int64_t y=0 ; y<h.height ; y++)
+		{
+			printf("%d ", grids[0][(x+1)*(h.height+2) + y + 1]);
+		}
+		putchar('\n');
+	}
+	free(grids[0]);
+	free(grids[1]);
+	return EXIT_SUCCESS;
+}
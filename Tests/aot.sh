@@ -0,0 +1,19 @@
+INTERPETER=$1
+shift
+TEST=$1
+shift
+DRIVER=$1
+shift
+CC=$1
+shift
+OUTPUT=$1
+shift
+# Compile the program ahead of time, link the object into a small C driver,
+# and check that the driver computes the same grid as the JIT from the same
+# grid file.
+"$INTERPETER" -x 37 -y 20 -m 3 -w "$OUTPUT.grid" "$TEST" || exit 1
+"$INTERPETER" -j -O2 -v -c "$OUTPUT.o" "$TEST" || exit 1
+"$CC" -std=c99 -o "$OUTPUT" "$DRIVER" "$OUTPUT.o" || exit 1
+EXPECTED=`"$INTERPETER" -j -r "$OUTPUT.grid" -i 5 "$TEST"` || exit 1
+ACTUAL=`"$OUTPUT" "$OUTPUT.grid" 5` || exit 1
+[ "$EXPECTED" = "$ACTUAL" ]
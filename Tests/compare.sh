@@ -0,0 +1,17 @@
+INTERPETER=$1
+shift
+TEST=$1
+shift
+# The remaining arguments are two sets of flags, separated by --.  Run the
+# program on the same random grid with each of them and check that the output
+# is identical.
+FLAGS=""
+while [ "$1" != "--" ]
+do
+	FLAGS="$FLAGS $1"
+	shift
+done
+shift
+EXPECTED=`"$INTERPETER" $FLAGS "$TEST"` || exit 1
+ACTUAL=`"$INTERPETER" $@ "$TEST"` || exit 1
+[ "$EXPECTED" = "$ACTUAL" ]
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Tests the C interface.  Runs a program on the same grid used by cellatom's
+ * -d flag with a compiled and a bytecode kernel, which exist at the same
+ * time, checks that they agree, and prints the result.
+ */
+#include "cellatom.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+	const char *runtimePath = NULL;
+	int c;
+	while ((c = getopt(argc, argv, "dr:")) != -1)
+	{
+		switch (c)
+		{
+			case 'd':
+				break;
+			case 'r':
+				runtimePath = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-d] -r {runtime path} {file name}\n",
+				        argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc)
+	{
+		fprintf(stderr, "No program specified\n");
+		return EXIT_FAILURE;
+	}
+	char error[256];
+	if (cellatom_parse("= v [", error, sizeof(error)) || error[0] == 0)
+	{
+		fprintf(stderr, "Invalid program was not rejected\n");
+		return EXIT_FAILURE;
+	}
+	cellatom_program *program = cellatom_load(argv[optind], error,
+	                                          sizeof(error));
+	if (!program)
+	{
+		fprintf(stderr, "%s\n", error);
+		return EXIT_FAILURE;
+	}
+	struct cellatom_options options;
+	cellatom_options_init(&options);
+	options.runtime_path = runtimePath;
+	options.threads = 0;
+	if (cellatom_kernel_create(program, &options, error, sizeof(error)) ||
+	    error[0] == 0)
+	{
+		fprintf(stderr, "Invalid options were not rejected\n");
+		return EXIT_FAILURE;
+	}
+	options.threads = 1;
+	cellatom_kernel *compiled = cellatom_kernel_create(program, &options, error,
+	                                                   sizeof(error));
+	if (!compiled)
+	{
+		fprintf(stderr, "%s\n", error);
+		return EXIT_FAILURE;
+	}
+	options.engine = CELLATOM_BYTECODE;
+	cellatom_kernel *bytecode = cellatom_kernel_create(program, &options, error,
+	                                                   sizeof(error));
+	if (!bytecode)
+	{
+		fprintf(stderr, "%s\n", error);
+		return EXIT_FAILURE;
+	}
+	// Kernels keep their own reference to the program.
+	cellatom_program_free(program);
+
+	const int64_t size = 5;
+	static const int16_t debug[] = {
+		 0,0,0,0,0,
+		 0,0,0,0,0,
+		 0,1,1,1,0,
+		 0,0,0,0,0,
+		 0,0,0,0,0
+	};
+	size_t cells = cellatom_grid_size(size, size);
+	int16_t *grids[4];
+	for (int i=0 ; i<4 ; i++)
+	{
+		grids[i] = calloc(cells, sizeof(int16_t));
+	}
+	for (int x=0 ; x<size ; x++)
+	{
+		for (int y=0 ; y<size ; y++)
+		{
+			grids[0][cellatom_grid_index(size, x, y)] = debug[x*size + y];
+			grids[2][cellatom_grid_index(size, x, y)] = debug[x*size + y];
+		}
+	}
+	int16_t *result = cellatom_step(compiled, grids[0], grids[1], size, size, 1);
+	int16_t *expected = cellatom_step(bytecode, grids[2], grids[3], size, size, 1);
+	int ret = EXIT_SUCCESS;
+	for (int x=0 ; x<size ; x++)
+	{
+		for (int y=0 ; y<size ; y++)
+		{
+			size_t i = cellatom_grid_index(size, x, y);
+			if (result[i] != expected[i])
+			{
+				fprintf(stderr, "Engines disagree at (%d, %d): %d != %d\n",
+				        x, y, result[i], expected[i]);
+				ret = EXIT_FAILURE;
+			}
+			printf("%d ", result[i]);
+		}
+		putchar('\n');
+	}
+	cellatom_kernel_free(compiled);
+	cellatom_kernel_free(bytecode);
+	for (int i=0 ; i<4 ; i++)
+	{
+		free(grids[i]);
+	}
+	return ret;
+}
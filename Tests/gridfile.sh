@@ -0,0 +1,17 @@
+INTERPETER=$1
+shift
+TEST=$1
+shift
+GRID=$1
+shift
+# Run the program for three generations, writing the result to a grid file,
+# and then two more starting from that file.  The result should be the same as
+# running all five at once.  The remaining arguments are passed to each run.
+"$INTERPETER" -x 20 -m 3 -i 3 -w "$GRID" $@ "$TEST" || exit 1
+EXPECTED=`"$INTERPETER" -x 20 -m 3 -i 5 $@ "$TEST"` || exit 1
+ACTUAL=`"$INTERPETER" -r "$GRID" -i 2 $@ "$TEST"` || exit 1
+[ "$EXPECTED" = "$ACTUAL" ] || exit 1
+# Writing the result over the input must be refused, leaving the file intact.
+BEFORE=`cksum < "$GRID"`
+"$INTERPETER" -r "$GRID" -i 2 -w "$GRID" $@ "$TEST" 2>/dev/null && exit 1
+[ "`cksum < "$GRID"`" = "$BEFORE" ]
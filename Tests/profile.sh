@@ -0,0 +1,16 @@
+INTERPETER=$1
+shift
+TEST=$1
+shift
+PROFILE=$1
+shift
+# Collect a profile while running the compiled program, then run it again
+# with its ranges reordered by the profile.  Both should give the same result
+# as the interpreter.  The remaining arguments are passed to each run.
+rm -f "$PROFILE"
+EXPECTED=`"$INTERPETER" $@ "$TEST"` || exit 1
+PROFILED=`"$INTERPETER" -j -I -P "$PROFILE" $@ "$TEST"` || exit 1
+[ "$EXPECTED" = "$PROFILED" ] || exit 1
+[ -s "$PROFILE" ] || exit 1
+ACTUAL=`"$INTERPETER" -j -O2 -P "$PROFILE" $@ "$TEST"` || exit 1
+[ "$EXPECTED" = "$ACTUAL" ]
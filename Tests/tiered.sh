@@ -0,0 +1,12 @@
+INTERPETER=$1
+shift
+TEST=$1
+shift
+# Run the program with -a, and check that the output is the same as running
+# the whole program with either the bytecode VM or the compiled version.  The
+# remaining arguments are passed to each run.
+ACTUAL=`"$INTERPETER" -a $@ "$TEST"` || exit 1
+BYTECODE=`"$INTERPETER" -b $@ "$TEST"` || exit 1
+[ "$ACTUAL" = "$BYTECODE" ] && exit 0
+COMPILED=`"$INTERPETER" -j $@ "$TEST"` || exit 1
+[ "$ACTUAL" = "$COMPILED" ]
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ast.hh"
+#include <algorithm>
+
+using namespace AST;
+
+namespace Analysis {
+/**
+ * A range of values that a register or expression may hold.  The bounds are
+ * clamped well inside the range of `int64_t`, so that repeatedly multiplying
+ * them can't overflow.
+ */
+struct Interval
+{
+  /** The smallest possible value */
+  int64_t min = 0;
+  /** The largest possible value */
+  int64_t max = 0;
+  Interval() {}
+  Interval(int64_t lo, int64_t hi)
+  {
+    const int64_t limit = int64_t(1) << 30;
+    min = std::max(-limit, std::min(lo, limit));
+    max = std::max(-limit, std::min(hi, limit));
+  }
+  /** Extends this interval to include all of the values in another */
+  void join(const Interval &o)
+  {
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+  }
+  bool operator!=(const Interval &o) const
+  {
+    return (min != o.min) || (max != o.max);
+  }
+};
+/**
+ * The possible values of each register at some point in a kernel.
+ */
+struct Registers
+{
+  /** The local registers, which start at zero for every cell */
+  Interval a[10];
+  /** The global registers */
+  Interval g[10];
+  /** The value of the cell */
+  Interval v;
+  /** Extends each register to include the values in another set */
+  void join(const Registers &o)
+  {
+    for (int i=0 ; i<10 ; i++)
+    {
+      a[i].join(o.a[i]);
+      g[i].join(o.g[i]);
+    }
+    v.join(o.v);
+  }
+};
+/**
+ * The results of analysing a kernel.
+ */
+struct State
+{
+  /** Which of the global registers are read */
+  bool globalRead[10] = {false};
+  /** Which of the global registers are written */
+  bool globalWritten[10] = {false};
+  /** Which of the local registers are written */
+  bool localWritten[10] = {false};
+  /** The possible values of the registers at the current point */
+  Registers registers;
+  /** The possible values of each neighbour of the cell */
+  Interval neighbour;
+  /**
+   * The possible values of the last statement analysed, or of the value
+   * being assigned to a register.
+   */
+  Interval result;
+  /** Every value that the kernel may compute or compare against */
+  Interval seen;
+  /** The number of operations that the kernel may perform for a cell */
+  unsigned operations = 0;
+  /** Records the registers that another analysis found to be used */
+  void addUses(const State &o)
+  {
+    for (int i=0 ; i<10 ; i++)
+    {
+      globalRead[i] |= o.globalRead[i];
+      globalWritten[i] |= o.globalWritten[i];
+      localWritten[i] |= o.localWritten[i];
+    }
+  }
+};
+
+bool usesGlobals(AST::StatementList *ast)
+{
+	Analysis::State state;
+	ast->analyse(state);
+	for (int i=0 ; i<10 ; i++)
+	{
+		if (state.globalRead[i] || state.globalWritten[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void classifyGlobals(AST::StatementList *ast, GlobalUse uses[10])
+{
+	Analysis::State state;
+	ast->analyse(state);
+	for (int i=0 ; i<10 ; i++)
+	{
+		// A register whose value is never read can't affect anything,
+		// whatever is written to it.
+		if (!state.globalRead[i])
+		{
+			uses[i] = GlobalUse::Unused;
+		}
+		else
+		{
+			uses[i] = state.globalWritten[i] ? GlobalUse::Ordered :
+			                                   GlobalUse::ReadOnly;
+		}
+	}
+}
+
+bool orderDependent(AST::StatementList *ast)
+{
+	GlobalUse uses[10];
+	classifyGlobals(ast, uses);
+	return std::find(uses, uses+10, GlobalUse::Ordered) != uses+10;
+}
+
+bool assignsLocal(AST::StatementList *ast, int registerNumber)
+{
+	Analysis::State state;
+	ast->analyse(state);
+	return state.localWritten[registerNumber];
+}
+
+unsigned operations(AST::StatementList *ast)
+{
+  Analysis::State state;
+  // Cells and global registers may hold any value, so no range can be
+  // skipped.
+  const int64_t limit = int64_t(1) << 30;
+  Interval any(-limit, limit);
+  state.registers.v = any;
+  state.neighbour = any;
+  std::fill(state.registers.g, state.registers.g+10, any);
+  ast->analyse(state);
+  return state.operations;
+}
+
+bool valuesFit(AST::StatementList *ast, int32_t initial, int32_t max)
+{
+	Analysis::State state;
+	// The values that cells may hold in any generation.  Neighbours are
+	// cells too (or the edge value, which the caller includes in `initial`).
+	Interval cells(0, initial);
+	state.seen = cells;
+	// Global registers keep their values from one cell to the next, so
+	// analyse the kernel again with the values that they (and the cells) may
+	// have after each cell until they stop growing.  Each pass either widens
+	// an interval or stops, and an interval that grows past the limit is
+	// also seen, so this terminates.
+	Interval globals[10];
+	for (;;)
+	{
+		state.registers = Registers();
+		state.registers.v = cells;
+		state.neighbour = cells;
+		std::copy(globals, globals+10, state.registers.g);
+		ast->analyse(state);
+		if ((state.seen.min < 0) || (state.seen.max > max))
+		{
+			return false;
+		}
+		bool changed = false;
+		auto widen = [&](Interval &i, const Interval &o)
+		{
+			Interval joined = i;
+			joined.join(o);
+			changed |= (joined != i);
+			i = joined;
+		};
+		for (int i=0 ; i<10 ; i++)
+		{
+			widen(globals[i], state.registers.g[i]);
+		}
+		widen(cells, state.registers.v);
+		if (!changed)
+		{
+			return true;
+		}
+	}
+}
+
+}  // namespace Analysis
+
+void Literal::analyse(Analysis::State &s)
+{
+	s.result = Analysis::Interval(value, value);
+	s.seen.join(s.result);
+}
+void LocalRegister::analyse(Analysis::State &s)
+{
+	assert(registerNumber >= 0 && registerNumber < 10);
+	s.result = s.registers.a[registerNumber];
+}
+void LocalRegister::assign(Analysis::State &s)
+{
+	assert(registerNumber >= 0 && registerNumber < 10);
+	s.localWritten[registerNumber] = true;
+	s.registers.a[registerNumber] = s.result;
+}
+void GlobalRegister::analyse(Analysis::State &s)
+{
+	assert(registerNumber >= 0 && registerNumber < 10);
+	s.globalRead[registerNumber] = true;
+	s.result = s.registers.g[registerNumber];
+}
+void GlobalRegister::assign(Analysis::State &s)
+{
+	assert(registerNumber >= 0 && registerNumber < 10);
+	s.globalWritten[registerNumber] = true;
+	s.registers.g[registerNumber] = s.result;
+}
+void VRegister::analyse(Analysis::State &s)
+{
+	s.result = s.registers.v;
+}
+void VRegister::assign(Analysis::State &s)
+{
+	s.registers.v = s.result;
+}
+
+void Arithmetic::analyse(Analysis::State &s)
+{
+	using Analysis::Interval;
+	value->analyse(s);
+	Interval v = s.result;
+	Interval result = v;
+	// Updating a global register reads its old value, but only to compute
+	// its new one, so that doesn't count as reading it.
+	GlobalRegister *global = dynamic_cast<GlobalRegister*>(target.get());
+	bool read = global && s.globalRead[global->registerNumber];
+	// All operations are read-modify-write, although assignment doesn't
+	// actually depend on the old value.
+	if (op.op != Op::Assign)
+	{
+		target->analyse(s);
+		Interval o = s.result;
+		switch (op.op)
+		{
+			case Op::Assign:
+				break;
+			case Op::Add:
+				result = Interval(o.min + v.min, o.max + v.max);
+				break;
+			case Op::Sub:
+				result = Interval(o.min - v.max, o.max - v.min);
+				break;
+			case Op::Mul:
+			{
+				int64_t products[] = { o.min * v.min, o.min * v.max,
+				                       o.max * v.min, o.max * v.max };
+				result = Interval(*std::min_element(products, products+4),
+				                  *std::max_element(products, products+4));
+				break;
+			}
+			case Op::Div:
+				// Any negative value means that the kernel doesn't fit, so
+				// only non-negative operands need to be handled precisely.
+				// Division by zero is undefined, so ignore it.
+				result = Interval(o.min / std::max<int64_t>(v.max, 1),
+				                  o.max / std::max<int64_t>(v.min, 1));
+				break;
+			case Op::Min:
+				result = Interval(std::min(o.min, v.min),
+				                  std::min(o.max, v.max));
+				break;
+			case Op::Max:
+				result = Interval(std::max(o.min, v.min),
+				                  std::max(o.max, v.max));
+				break;
+		}
+	}
+	s.seen.join(result);
+	s.result = result;
+	target->assign(s);
+	if (global)
+	{
+		s.globalRead[global->registerNumber] = read;
+	}
+	s.operations++;
+	// Arithmetic statements don't have a value.
+	s.result = Interval();
+}
+
+void RangeExpr::analyse(Analysis::State &s)
+{
+	value->analyse(s);
+	Analysis::Interval input = s.result;
+	s.seen.join(input);
+	// Each range is tested in turn until one matches.
+	s.operations += ranges.size();
+	// If no range matches, then the result is zero.
+	Analysis::Interval result;
+	for (auto &range : ranges)
+	{
+		int64_t start = range->end->value;
+		if (range->start.get())
+		{
+			range->start->analyse(s);
+			start = range->start->value;
+		}
+		range->end->analyse(s);
+		Analysis::Interval match(std::max(input.min, start),
+		                         std::min<int64_t>(input.max, range->end->value));
+		// Skip the values of ranges that the input can never be in, but still
+		// record the registers that they use.
+		if (match.min > match.max)
+		{
+			Analysis::State unreachable = s;
+			range->value->analyse(unreachable);
+			s.addUses(unreachable);
+			continue;
+		}
+		// While computing the value for a range, the register being tested
+		// is known to be in that range.  Refine it in a copy of the state, so
+		// that this doesn't count as an assignment.
+		Analysis::Registers before = s.registers;
+		Analysis::State refined = s;
+		refined.result = match;
+		value->assign(refined);
+		s.registers = refined.registers;
+		range->value->analyse(s);
+		result.join(s.result);
+		s.registers.join(before);
+	}
+	s.seen.join(result);
+	s.result = result;
+}
+
+void Neighbours::analyse(Analysis::State &s)
+{
+	// The body runs once for each neighbour, so the registers afterwards
+	// may hold the values from any number of iterations.
+	Analysis::Registers after = s.registers;
+	for (int i=0 ; i<8 ; i++)
+	{
+		s.registers.a[0] = s.neighbour;
+		s.operations++;
+		statements->analyse(s);
+		after.join(s.registers);
+	}
+	s.registers = after;
+	s.result = Analysis::Interval();
+}
+
+void StatementList::analyse(Analysis::State &s)
+{
+	for (auto &st : statements)
+	{
+		st->analyse(s);
+	}
+}
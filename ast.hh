@@ -21,7 +21,10 @@
 #ifndef CELLATOM_AST_H_INCLUDED
 #define CELLATOM_AST_H_INCLUDED
 #include <stdint.h>
+#include <memory>
+#include <vector>
 #include "Pegmatite/pegmatite.hh"
+#include "grid.hh"
 
 namespace AST
 {
@@ -35,13 +38,82 @@ namespace Interpreter
 	 */
 	struct State;
 	/**
-	 * Run the AST interpreter over a grid for one iteration.
+	 * Run the AST interpreter for one iteration over the cells of a grid with
+	 * x in [xStart, xEnd) and y in [yStart, yEnd).  Each call has its own set
+	 * of global registers, so calls on disjoint sets of cells may run
+	 * concurrently.  Unless the boundary mode is `Truncate`, the halo of the
+	 * old grid must have been filled in.
 	 */
 	void runOneStep(int16_t *oldgrid,
 	                int16_t *newgrid,
-	                int16_t width,
-	                int16_t height,
-	                AST::StatementList *ast);
+	                Grid::Coordinate width,
+	                Grid::Coordinate height,
+	                Grid::Coordinate xStart,
+	                Grid::Coordinate xEnd,
+	                Grid::Coordinate yStart,
+	                Grid::Coordinate yEnd,
+	                AST::StatementList *ast,
+	                Grid::Boundary boundary);
+}
+
+namespace Analysis
+{
+	/**
+	 * Class encapsulating the state of a static analysis of a kernel.
+	 */
+	struct State;
+	/**
+	 * Returns true if the kernel reads or writes any global registers.
+	 */
+	bool usesGlobals(AST::StatementList *ast);
+	/**
+	 * How a kernel uses a global register.  Every call to a kernel starts
+	 * with the global registers at zero, and the cells are computed in order.
+	 */
+	enum class GlobalUse
+	{
+		/**
+		 * The register is never read, except by the statements that update
+		 * it, so its value can never reach a cell and writing it is dead.
+		 */
+		Unused,
+		/** The register is read but never written, so it is always zero */
+		ReadOnly,
+		/**
+		 * The register is both read and written, so a cell may see the
+		 * values written for the cells before it, and the results depend on
+		 * the order in which the cells are computed.
+		 */
+		Ordered
+	};
+	/**
+	 * Finds how the kernel uses each of the ten global registers.
+	 */
+	void classifyGlobals(AST::StatementList *ast, GlobalUse uses[10]);
+	/**
+	 * Returns true if any global register is `Ordered`.  Only these kernels
+	 * need their cells to be computed in order, on a single thread.  The
+	 * results of any other kernel are the same however the grid is divided.
+	 */
+	bool orderDependent(AST::StatementList *ast);
+	/**
+	 * Returns true if the statements assign to the specified local register.
+	 */
+	bool assignsLocal(AST::StatementList *ast, int registerNumber);
+	/**
+	 * Returns an upper bound on the number of operations (arithmetic
+	 * statements, range tests and neighbour reads) that the kernel performs
+	 * for each cell.  Kernels have no unbounded loops, so there always is one.
+	 */
+	unsigned operations(AST::StatementList *ast);
+	/**
+	 * Returns true if, when every cell (and every neighbour beyond the edges
+	 * of the grid) starts with a value in the range [0, initial], every value
+	 * that the kernel computes in any later generation, and every literal
+	 * that it uses, is in the range [0, max].  The grid can then be stored in
+	 * a narrower type.
+	 */
+	bool valuesFit(AST::StatementList *ast, int32_t initial, int32_t max);
 }
 
 namespace Compiler
@@ -50,22 +122,179 @@ namespace Compiler
 	 * Class encapsulating the compiler state.
 	 */
 	struct State;
+	/**
+	 * The memory holding the machine code for a compiled automaton.  The code
+	 * is freed when this is destroyed, so the automaton must not be called
+	 * after that.
+	 */
+	class Code
+	{
+		public:
+		virtual ~Code() {}
+	};
+	/**
+	 * A profile of how often each range in each range expression matched.
+	 * Range expressions are numbered in the order that they appear in the
+	 * program.  Each has one count for each of its ranges, followed by one
+	 * for the values that matched none of them.
+	 */
+	struct Profile
+	{
+		/**
+		 * Whether the compiled code should add to the counts as it runs.
+		 * Only the scalar kernels count, so instrumented kernels should not
+		 * be vectorised.  The profile must outlive the compiled code.
+		 */
+		bool instrument = false;
+		/** The number of counts for each range expression */
+		std::vector<unsigned> arms;
+		/** The counts for every range expression, one after another */
+		std::vector<uint64_t> counts;
+		/**
+		 * Reads a profile from a file.  Returns false, leaving the profile
+		 * empty, if the file doesn't exist or isn't a profile.
+		 */
+		bool load(const std::string &file);
+		/**
+		 * Writes the profile to a file.  Returns false, after reporting the
+		 * error, if it can't be written.
+		 */
+		bool save(const std::string &file) const;
+	};
 	/**
 	 * A function representing a compiled cellular automaton that will run for
-	 * a single step.
+	 * a single step over the cells with x in [xStart, xEnd) and y in [yStart,
+	 * yEnd).  As with the interpreter, each call has its own set of global
+	 * registers.
 	 */
 	typedef void(*automaton)(int16_t *oldgrid,
 	                         int16_t *newgrid,
-	                         int16_t width,
-	                         int16_t height);
+	                         Grid::Coordinate width,
+	                         Grid::Coordinate height,
+	                         Grid::Coordinate xStart,
+	                         Grid::Coordinate xEnd,
+	                         Grid::Coordinate yStart,
+	                         Grid::Coordinate yEnd);
 	/**
 	 * Compile the AST.  The optimisation level indicates how aggressive
-	 * optimisation should be.  Zero indicates no optimisation.  The `path`
-	 * argument tells the compiler where to look for the `runtime.bc` file.
+	 * optimisation should be.  Zero indicates no optimisation.  If
+	 * `vectorise` is true, then the compiler will also generate a kernel that
+	 * operates on as many cells at once as fit in a vector register on the
+	 * target.  The boundary mode determines how the neighbours of cells at
+	 * the edges of the grid are found.  The `path` argument tells the
+	 * compiler where to look for the `runtime.bc` file.  If
+	 * `cacheDirectory` is not empty, then compiled code is stored there and
+	 * reused by later compilations of the same program with the same
+	 * settings on the same machine.  The returned function is valid for as
+	 * long as `code`, which is set to the object that owns it.  If `profile`
+	 * is not null, then the tests in range expressions are laid out for the
+	 * counts in it, and if it is being collected then the code adds to them
+	 * (and is never cached).  Returns null if the code can't be generated, in
+	 * which case `lastError` gives the reason.
 	 */
 	automaton compile(AST::StatementList *ast,
 	                  int optimiseLevel,
-	                  const std::string &path);
+	                  bool vectorise,
+	                  Grid::Boundary boundary,
+	                  const std::string &path,
+	                  const std::string &cacheDirectory,
+	                  std::unique_ptr<Code> &code,
+	                  Profile *profile=nullptr);
+	/**
+	 * A compiled cellular automaton that stores each cell in 8 bits.
+	 */
+	typedef void(*narrowAutomaton)(int8_t *oldgrid,
+	                               int8_t *newgrid,
+	                               Grid::Coordinate width,
+	                               Grid::Coordinate height,
+	                               Grid::Coordinate xStart,
+	                               Grid::Coordinate xEnd,
+	                               Grid::Coordinate yStart,
+	                               Grid::Coordinate yEnd);
+	/**
+	 * Compile the AST for a grid of 8-bit cells.  This must only be used if
+	 * `Analysis::valuesFit` shows that every value fits in the range [0,
+	 * 127].  The arguments are the same as for `compile`, and the vector
+	 * kernel has twice as many lanes.
+	 */
+	narrowAutomaton compileNarrow(AST::StatementList *ast,
+	                              int optimiseLevel,
+	                              bool vectorise,
+	                              Grid::Boundary boundary,
+	                              const std::string &path,
+	                              const std::string &cacheDirectory,
+	                              std::unique_ptr<Code> &code,
+	                              Profile *profile=nullptr);
+	/**
+	 * A compiled cellular automaton for an ensemble of `count` grids of the
+	 * same size, interleaved as described in grid.hh, which runs a single
+	 * step over the cells with x in [xStart, xEnd) and y in [yStart, yEnd)
+	 * of every member.  Each member has its own set of global registers, and
+	 * `globals` must have room for `10 * count` of them.  Their values on
+	 * entry are ignored.
+	 */
+	typedef void(*ensembleAutomaton)(int16_t *oldgrid,
+	                                 int16_t *newgrid,
+	                                 Grid::Coordinate width,
+	                                 Grid::Coordinate height,
+	                                 int count,
+	                                 Grid::Coordinate xStart,
+	                                 Grid::Coordinate xEnd,
+	                                 Grid::Coordinate yStart,
+	                                 Grid::Coordinate yEnd,
+	                                 int16_t *globals);
+	/**
+	 * Compile the AST for an ensemble of grids.  The kernel is always
+	 * vectorised across members, even if it uses global registers.  The other
+	 * arguments are the same as for `compile`.
+	 */
+	ensembleAutomaton compileEnsemble(AST::StatementList *ast,
+	                                  int optimiseLevel,
+	                                  Grid::Boundary boundary,
+	                                  const std::string &path,
+	                                  const std::string &cacheDirectory,
+	                                  std::unique_ptr<Code> &code);
+	/**
+	 * The wall-clock time, in seconds, spent in each part of a compilation.
+	 */
+	struct CompileTimes
+	{
+		/** Generating the IR for the kernels */
+		double irGeneration = 0;
+		/** Running the optimisation passes */
+		double optimisation = 0;
+		/** Generating machine code, or loading it from the cache */
+		double codeGeneration = 0;
+	};
+	/**
+	 * Returns the times for the most recent compilation on the calling thread.
+	 */
+	CompileTimes lastCompileTimes();
+	/**
+	 * Returns the reason that the most recent compilation on the calling
+	 * thread failed, or an empty string if it succeeded.
+	 */
+	const std::string &lastError();
+	/**
+	 * Compile the AST, as for `compile`, and write the result to a file
+	 * instead of running it.  The file is an object file, or LLVM bitcode if
+	 * its name ends in `.bc`, or a shared library if it ends in `.so`.  It
+	 * exports a single function, `cellatom_automaton`, with the same
+	 * signature as `automaton`, which is compiled for the CPU of this
+	 * machine.  Returns false, after reporting the error, if the file can't be
+	 * written.
+	 */
+	bool compileToFile(AST::StatementList *ast,
+	                   int optimiseLevel,
+	                   bool vectorise,
+	                   Grid::Boundary boundary,
+	                   const std::string &path,
+	                   const std::string &file);
+}
+namespace Bytecode
+{
+	struct State;
+	struct Operand;
 }
 namespace llvm
 {
@@ -89,6 +318,15 @@ namespace AST
 		 * if there is one.
 		 */
 		virtual llvm::Value *compile(Compiler::State &) = 0;
+		/**
+		 * Compile this node to bytecode, returning the operand that holds the
+		 * result, if there is one.
+		 */
+		virtual Bytecode::Operand compile(Bytecode::State &) = 0;
+		/**
+		 * Analyse this node, recording the results in the analysis state.
+		 */
+		virtual void analyse(Analysis::State &) = 0;
 	};
 
 	/**
@@ -102,6 +340,8 @@ namespace AST
 		pegmatite::ASTList<Statement> statements;
 		uint16_t interpret(Interpreter::State&) override;
 		virtual llvm::Value *compile(Compiler::State &) override;
+		Bytecode::Operand compile(Bytecode::State &) override;
+		void analyse(Analysis::State &) override;
 	};
 
 	/**
@@ -118,6 +358,8 @@ namespace AST
 		               pegmatite::ASTStack &st,
 		               const pegmatite::ErrorReporter &) override;
 		llvm::Value *compile(Compiler::State &) override;
+		Bytecode::Operand compile(Bytecode::State &) override;
+		void analyse(Analysis::State &) override;
 	};
 
 	/**
@@ -138,11 +380,23 @@ namespace AST
 		 * compiling).
 		 */
 		virtual llvm::Value *compile(Compiler::State &) = 0;
+		/**
+		 * Returns the bytecode register operand for this register.
+		 */
+		virtual Bytecode::Operand compile(Bytecode::State &) = 0;
 		/**
 		 * Generates code for assigning the specified value to this register
 		 * (when compiling).
 		 */
 		virtual void assign(Compiler::State &, llvm::Value*) = 0;
+		/**
+		 * Records an access to this register (when analysing).
+		 */
+		virtual void analyse(Analysis::State &) = 0;
+		/**
+		 * Records an assignment to this register (when analysing).
+		 */
+		virtual void assign(Analysis::State &) = 0;
 	};
 
 	/**
@@ -154,6 +408,9 @@ namespace AST
 		virtual void assign(Interpreter::State &, uint16_t) override;
 		virtual llvm::Value *compile(Compiler::State &) override;
 		virtual void assign(Compiler::State &, llvm::Value*) override;
+		virtual Bytecode::Operand compile(Bytecode::State &) override;
+		virtual void analyse(Analysis::State &) override;
+		virtual void assign(Analysis::State &) override;
 	};
 
 	/**
@@ -173,6 +430,9 @@ namespace AST
 		void assign(Interpreter::State &, uint16_t) override;
 		llvm::Value *compile(Compiler::State &) override;
 		void assign(Compiler::State &, llvm::Value*) override;
+		Bytecode::Operand compile(Bytecode::State &) override;
+		void analyse(Analysis::State &) override;
+		void assign(Analysis::State &) override;
 	};
 
 	/**
@@ -192,6 +452,9 @@ namespace AST
 		void assign(Interpreter::State &, uint16_t) override;
 		llvm::Value *compile(Compiler::State &) override;
 		void assign(Compiler::State &, llvm::Value*) override;
+		Bytecode::Operand compile(Bytecode::State &) override;
+		void analyse(Analysis::State &) override;
+		void assign(Analysis::State &) override;
 	};
 	/**
 	 * Value representing the operation to use in an arithmetic / assignment
@@ -237,6 +500,8 @@ namespace AST
 		pegmatite::ASTPtr<Statement>  value;
 		virtual uint16_t interpret(Interpreter::State &) override;
 		virtual llvm::Value *compile(Compiler::State &) override;
+		virtual Bytecode::Operand compile(Bytecode::State &) override;
+		virtual void analyse(Analysis::State &) override;
 	};
 
 	/**
@@ -276,6 +541,8 @@ namespace AST
 		pegmatite::ASTList<Range>   ranges;
 		virtual uint16_t interpret(Interpreter::State &) override;
 		virtual llvm::Value *compile(Compiler::State &) override;
+		virtual Bytecode::Operand compile(Bytecode::State &) override;
+		virtual void analyse(Analysis::State &) override;
 	};
 
 	/**
@@ -289,6 +556,8 @@ namespace AST
 		pegmatite::ASTPtr<StatementList> statements;
 		virtual uint16_t interpret(Interpreter::State &) override;
 		virtual llvm::Value *compile(Compiler::State &) override;
+		virtual Bytecode::Operand compile(Bytecode::State &) override;
+		virtual void analyse(Analysis::State &) override;
 	};
 
 
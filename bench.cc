@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Benchmarks the engines.  Runs each program with the interpreter, the
+ * bytecode VM and the compiled engine at each optimisation level, on random
+ * grids of several sizes for several iteration counts, and reports the
+ * compile time and the time per run as CSV or JSON.
+ */
+#include "cellatom.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <libgen.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace CellAtom;
+
+/**
+ * One configuration of an engine.
+ */
+struct EngineConfig
+{
+	/** The name in the report */
+	const char *name;
+	/** The engine */
+	Engine engine;
+	/** The optimisation level, for the compiled engine */
+	int optimiseLevel;
+};
+
+/**
+ * The measurements for one program, engine, grid size and iteration count.
+ */
+struct Result
+{
+	std::string program;
+	const char *engine;
+	int size;
+	int iterations;
+	/** The time taken to create the kernel, including compiling it */
+	double compileSeconds;
+	/** The mean time of each measured run */
+	double meanSeconds;
+	/** The standard deviation of the measured runs */
+	double stddevSeconds;
+	/** The fastest measured run */
+	double minSeconds;
+	/** The cells computed per second, from the mean */
+	double cellsPerSecond;
+};
+
+/**
+ * Returns the number of seconds since `start`.
+ */
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+/**
+ * Parses a comma-separated list of positive numbers.  Returns an empty list if
+ * any of them is invalid.
+ */
+static std::vector<int> parseList(const char *arg)
+{
+	std::vector<int> values;
+	std::istringstream in(arg);
+	std::string item;
+	while (std::getline(in, item, ','))
+	{
+		char *end;
+		long value = strtol(item.c_str(), &end, 10);
+		if (item.empty() || *end != '\0' || value < 1)
+		{
+			return std::vector<int>();
+		}
+		values.push_back(value);
+	}
+	return values;
+}
+
+/**
+ * Writes the results as CSV, with a header line.
+ */
+static void writeCSV(FILE *out, const std::vector<Result> &results)
+{
+	fprintf(out, "program,engine,size,iterations,compile_seconds,mean_seconds,stddev_seconds,min_seconds,cells_per_second\n");
+	for (auto &r : results)
+	{
+		fprintf(out, "%s,%s,%d,%d,%g,%g,%g,%g,%g\n", r.program.c_str(),
+		        r.engine, r.size, r.iterations, r.compileSeconds,
+		        r.meanSeconds, r.stddevSeconds, r.minSeconds,
+		        r.cellsPerSecond);
+	}
+}
+
+/**
+ * Writes the results as a JSON array of objects, with the same fields as the
+ * CSV output.  Program names are file names, which are assumed not to need
+ * escaping.
+ */
+static void writeJSON(FILE *out, const std::vector<Result> &results)
+{
+	fprintf(out, "[\n");
+	for (size_t i=0 ; i<results.size() ; i++)
+	{
+		const Result &r = results[i];
+		fprintf(out, "  {\"program\": \"%s\", \"engine\": \"%s\", \"size\": %d, "
+		        "\"iterations\": %d, \"compile_seconds\": %g, "
+		        "\"mean_seconds\": %g, \"stddev_seconds\": %g, "
+		        "\"min_seconds\": %g, \"cells_per_second\": %g}%s\n",
+		        r.program.c_str(), r.engine, r.size, r.iterations,
+		        r.compileSeconds, r.meanSeconds, r.stddevSeconds,
+		        r.minSeconds, r.cellsPerSecond,
+		        (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(out, "]\n");
+}
+
+int main(int argc, char **argv)
+{
+	std::string cmd = argv[0];
+	Options options;
+	options.runtimePath = dirname(argv[0]);
+	std::vector<int> sizes = { 64, 512 };
+	std::vector<int> iterationCounts = { 10, 100 };
+	int warmups = 1;
+	int repetitions = 5;
+	int maxValue = 1;
+	bool json = false;
+	const char *outputFile = nullptr;
+	int c;
+	auto usage = [=]() {
+		fprintf(stderr, "usage: %s [-J] -x {sizes} -i {iterations} -w {warmups} -r {repetitions} -m {max} -p {threads} -T {size} -R {directory} -o {output} {file names}\n"
+		        " -J          Write JSON instead of CSV\n"
+		        " -x {sizes}  Comma-separated grid sizes [default: 64,512]\n"
+		        " -i {iterations} Comma-separated iteration counts [default: 10,100]\n"
+		        " -w {warmups} Unmeasured runs before each measurement [default: 1]\n"
+		        " -r {repetitions} Measured runs of each configuration [default: 5]\n"
+		        " -m {max}    The maximum value for the random grids [default: 1]\n"
+		        " -p {threads} Run on this many threads [default: 1]\n"
+		        " -T {size}   Skip size by size tiles that can't change, or 0 to compute every cell [default: 32]\n"
+		        " -R {directory} The directory containing runtime.bc [default: the directory of this program]\n"
+		        " -o {output} Write the results to this file [default: standard output]\n"
+		        " {file names} The .ca sources to run\n", cmd.c_str());
+	};
+	while ((c = getopt(argc, argv, "Ji:m:o:p:R:r:T:w:x:")) != -1)
+	{
+		switch (c)
+		{
+			default:
+				usage();
+				return EXIT_FAILURE;
+			case 'J':
+				json = true;
+				break;
+			case 'i':
+				iterationCounts = parseList(optarg);
+				break;
+			case 'm':
+				maxValue = strtol(optarg, 0, 10);
+				break;
+			case 'o':
+				outputFile = optarg;
+				break;
+			case 'p':
+				options.threads = strtol(optarg, 0, 10);
+				break;
+			case 'R':
+				options.runtimePath = optarg;
+				break;
+			case 'r':
+				repetitions = strtol(optarg, 0, 10);
+				break;
+			case 'T':
+				options.tileSize = strtol(optarg, 0, 10);
+				break;
+			case 'w':
+				warmups = strtol(optarg, 0, 10);
+				break;
+			case 'x':
+				sizes = parseList(optarg);
+				break;
+		}
+	}
+	if (optind >= argc)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+	if (sizes.empty() || iterationCounts.empty() ||
+	    *std::min_element(sizes.begin(), sizes.end()) < 1)
+	{
+		fprintf(stderr, "Sizes must be at least 1 and iteration counts positive\n");
+		return EXIT_FAILURE;
+	}
+	if (repetitions < 1 || warmups < 0 || options.threads < 1)
+	{
+		fprintf(stderr, "There must be at least one repetition and thread\n");
+		return EXIT_FAILURE;
+	}
+	const EngineConfig engines[] = {
+		{ "interpreter", Engine::Interpreter, 0 },
+		{ "bytecode", Engine::Bytecode, 0 },
+		{ "jit-O0", Engine::Compiled, 0 },
+		{ "jit-O1", Engine::Compiled, 1 },
+		{ "jit-O2", Engine::Compiled, 2 },
+		{ "jit-O3", Engine::Compiled, 3 }
+	};
+	std::vector<Result> results;
+	for (int f=optind ; f<argc ; f++)
+	{
+		std::string error;
+		std::unique_ptr<Program> program = Program::load(argv[f], error);
+		if (!program)
+		{
+			fprintf(stderr, "%s\n", error.c_str());
+			return EXIT_FAILURE;
+		}
+		for (auto &e : engines)
+		{
+			options.engine = e.engine;
+			options.optimiseLevel = e.optimiseLevel;
+			auto start = std::chrono::steady_clock::now();
+			std::unique_ptr<Kernel> kernel = Kernel::create(*program, options,
+			                                                error);
+			if (!kernel)
+			{
+				fprintf(stderr, "%s\n", error.c_str());
+				return EXIT_FAILURE;
+			}
+			double compileSeconds = secondsSince(start);
+			for (int size : sizes)
+			{
+				// Every engine runs the same grid, so that their results can be
+				// compared.
+				size_t cells = Grid::size(size, size);
+				std::vector<int16_t> initial(cells);
+				srandom(size);
+				for (int x=0 ; x<size ; x++)
+				{
+					for (int y=0 ; y<size ; y++)
+					{
+						initial[Grid::index(size, x, y)] =
+							random() % (maxValue + 1);
+					}
+				}
+				std::vector<int16_t> grid(cells);
+				std::vector<int16_t> spare(cells);
+				for (int iterations : iterationCounts)
+				{
+					std::vector<double> times;
+					for (int i=0 ; i<warmups+repetitions ; i++)
+					{
+						std::copy(initial.begin(), initial.end(), grid.begin());
+						start = std::chrono::steady_clock::now();
+						kernel->step(grid.data(), spare.data(), size, size,
+						            iterations);
+						if (i >= warmups)
+						{
+							times.push_back(secondsSince(start));
+						}
+					}
+					double mean = 0;
+					for (double t : times)
+					{
+						mean += t;
+					}
+					mean /= times.size();
+					double variance = 0;
+					for (double t : times)
+					{
+						variance += (t - mean) * (t - mean);
+					}
+					variance /= times.size();
+					Result r;
+					r.program = argv[f];
+					r.engine = e.name;
+					r.size = size;
+					r.iterations = iterations;
+					r.compileSeconds = compileSeconds;
+					r.meanSeconds = mean;
+					r.stddevSeconds = sqrt(variance);
+					r.minSeconds = *std::min_element(times.begin(), times.end());
+					r.cellsPerSecond = static_cast<double>(size) * size *
+					                   iterations / mean;
+					results.push_back(r);
+				}
+			}
+		}
+	}
+	FILE *out = outputFile ? fopen(outputFile, "w") : stdout;
+	if (!out)
+	{
+		perror(outputFile);
+		return EXIT_FAILURE;
+	}
+	if (json)
+	{
+		writeJSON(out, results);
+	}
+	else
+	{
+		writeCSV(out, results);
+	}
+	return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "bitslice.hh"
+#include "ast.hh"
+#include <algorithm>
+#include <string.h>
+
+namespace BitSlice
+{
+
+namespace
+{
+/**
+ * Runs the kernel for the cell at (x, y) in a grid of width by height cells,
+ * with truncated neighbourhoods, and returns its new value.  The values of the
+ * cells are given by the bits of `cells`, in the same order as the grid.
+ */
+uint16_t runCell(AST::StatementList *ast,
+                 int16_t width,
+                 int16_t height,
+                 unsigned cells,
+                 int16_t x,
+                 int16_t y)
+{
+	int16_t oldgrid[(3+2)*(3+2)] = {0};
+	int16_t newgrid[(3+2)*(3+2)] = {0};
+	for (int i=0 ; i<width ; i++)
+	{
+		for (int j=0 ; j<height ; j++)
+		{
+			oldgrid[Grid::index(height, i, j)] = (cells >> (i*height + j)) & 1;
+		}
+	}
+	Interpreter::runOneStep(oldgrid, newgrid, width, height, x, x+1, y, y+1,
+	                        ast, Grid::Boundary::Truncate);
+	return newgrid[Grid::index(height, x, y)];
+}
+
+/**
+ * Adds three bit vectors, giving the low bit of each sum in `sum` and the high
+ * bit in `carry`.
+ */
+inline void fullAdder(uint64_t a, uint64_t b, uint64_t c,
+                      uint64_t &sum, uint64_t &carry)
+{
+	uint64_t t = a ^ b;
+	sum = t ^ c;
+	carry = (a & b) | (t & c);
+}
+
+/**
+ * Adds two bit vectors, giving the low bit of each sum in `sum` and the high
+ * bit in `carry`.
+ */
+inline void halfAdder(uint64_t a, uint64_t b, uint64_t &sum, uint64_t &carry)
+{
+	sum = a ^ b;
+	carry = a & b;
+}
+}
+
+bool analyse(AST::StatementList *ast,
+             Grid::Boundary boundary,
+             int16_t edgeValue,
+             Rule &rule)
+{
+	// The result must depend only on the neighbourhood.
+	if (Analysis::orderDependent(ast))
+	{
+		return false;
+	}
+	// Neighbours beyond the edges must also be zero or one.
+	if ((boundary == Grid::Boundary::Constant) &&
+	    (edgeValue != 0) && (edgeValue != 1))
+	{
+		return false;
+	}
+	// Run the kernel on every 3x3 neighbourhood.  The result must be zero or
+	// one, and must depend only on the value of the cell and the number of
+	// neighbours that are one.
+	int table[2][9];
+	memset(table, -1, sizeof(table));
+	for (unsigned cells=0 ; cells<(1<<9) ; cells++)
+	{
+		const unsigned centre = 1<<4;
+		int v = (cells & centre) ? 1 : 0;
+		int count = __builtin_popcount(cells & ~centre);
+		uint16_t result = runCell(ast, 3, 3, cells, 1, 1);
+		if ((result > 1) ||
+		    ((table[v][count] != -1) && (table[v][count] != result)))
+		{
+			return false;
+		}
+		table[v][count] = result;
+	}
+	rule = Rule();
+	for (int count=0 ; count<=8 ; count++)
+	{
+		rule.born |= table[0][count] << count;
+		rule.survive |= table[1][count] << count;
+	}
+	// With truncated neighbourhoods, the cells at the edges have fewer
+	// neighbours, but the bit grid treats the missing ones as zero.  Check
+	// that this gives the same result for every number of neighbours that a
+	// cell can have.  The order in which the neighbours are visited doesn't
+	// depend on where they are, so one cell with each number of neighbours
+	// is enough.
+	if (boundary == Grid::Boundary::Truncate)
+	{
+		struct { int16_t width, height, x, y; } edges[] = {
+			{ 1, 1, 0, 0 },
+			{ 1, 2, 0, 0 },
+			{ 1, 3, 0, 1 },
+			{ 2, 2, 0, 0 },
+			{ 2, 3, 0, 1 }
+		};
+		for (auto &e : edges)
+		{
+			unsigned size = e.width * e.height;
+			unsigned centre = 1 << (e.x * e.height + e.y);
+			for (unsigned cells=0 ; cells<(1U<<size) ; cells++)
+			{
+				int v = (cells & centre) ? 1 : 0;
+				int count = __builtin_popcount(cells & ~centre);
+				if (runCell(ast, e.width, e.height, cells, e.x, e.y) !=
+				    table[v][count])
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool isTwoState(const int16_t *grid,
+                Grid::Coordinate width,
+                Grid::Coordinate height)
+{
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		for (Grid::Coordinate y=0 ; y<height ; y++)
+		{
+			int16_t v = grid[Grid::index(height, x, y)];
+			if ((v != 0) && (v != 1))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+BitGrid::BitGrid(Grid::Coordinate w,
+                 Grid::Coordinate h,
+                 Grid::Boundary b,
+                 int16_t e)
+	: width(w), height(h), boundary(b), edgeValue(e),
+	  wordsPerRow((h + 2 + 63) / 64),
+	  current((w + 2) * wordsPerRow), next((w + 2) * wordsPerRow)
+{
+}
+
+void BitGrid::load(const int16_t *grid)
+{
+	std::fill(current.begin(), current.end(), 0);
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		uint64_t *r = row(x);
+		for (Grid::Coordinate y=0 ; y<height ; y++)
+		{
+			uint64_t bit = grid[Grid::index(height, x, y)] ? 1 : 0;
+			r[(y + 1) / 64] |= bit << ((y + 1) % 64);
+		}
+	}
+}
+
+void BitGrid::store(int16_t *grid)
+{
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		uint64_t *r = row(x);
+		for (Grid::Coordinate y=0 ; y<height ; y++)
+		{
+			grid[Grid::index(height, x, y)] = (r[(y + 1) / 64] >> ((y + 1) % 64)) & 1;
+		}
+	}
+}
+
+void BitGrid::fillHalo()
+{
+	bool wrap = (boundary == Grid::Boundary::Wrap);
+	bool edge = (boundary == Grid::Boundary::Constant) && (edgeValue == 1);
+	auto get = [](uint64_t *r, Grid::Coordinate bit)
+	{
+		return (r[bit / 64] >> (bit % 64)) & 1;
+	};
+	auto set = [](uint64_t *r, Grid::Coordinate bit, uint64_t value)
+	{
+		r[bit / 64] = (r[bit / 64] & ~(uint64_t(1) << (bit % 64))) |
+		              (value << (bit % 64));
+	};
+	// The cells beyond each end of every row.
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		uint64_t *r = row(x);
+		set(r, 0, wrap ? get(r, height) : edge);
+		set(r, height + 1, wrap ? get(r, 1) : edge);
+	}
+	// The rows beyond each edge, including the corners.
+	if (wrap)
+	{
+		std::copy(row(width - 1), row(width), row(-1));
+		std::copy(row(0), row(1), row(width));
+	}
+	else
+	{
+		std::fill(row(-1), row(0), edge ? ~uint64_t(0) : 0);
+		std::fill(row(width), row(width + 1), edge ? ~uint64_t(0) : 0);
+	}
+}
+
+void BitGrid::step(const Rule &rule, ThreadPool &pool)
+{
+	fillHalo();
+	// The neighbour counts that give a one, as bit planes, and whether they
+	// do for cells that are currently zero, one, or both.
+	struct Term
+	{
+		uint64_t count[4];
+		uint64_t whenZero;
+		uint64_t whenOne;
+	};
+	std::vector<Term> terms;
+	for (int count=0 ; count<=8 ; count++)
+	{
+		bool born = rule.born & (1 << count);
+		bool survive = rule.survive & (1 << count);
+		if (born || survive)
+		{
+			Term term;
+			for (int bit=0 ; bit<4 ; bit++)
+			{
+				term.count[bit] = (count & (1 << bit)) ? ~uint64_t(0) : 0;
+			}
+			term.whenZero = born ? ~uint64_t(0) : 0;
+			term.whenOne = survive ? ~uint64_t(0) : 0;
+			terms.push_back(term);
+		}
+	}
+	int threads = pool.size();
+	pool.run([&](int band) {
+		Grid::Coordinate xEnd = width * (band + 1) / threads;
+		for (Grid::Coordinate x = width * band / threads ; x<xEnd ; x++)
+		{
+			const uint64_t *rows[3] = { row(x - 1), row(x), row(x + 1) };
+			uint64_t *out = &next[(x + 1) * wordsPerRow];
+			for (int k=0 ; k<wordsPerRow ; k++)
+			{
+				// Find the eight neighbours of each of the 64 cells.  Bit i
+				// of a word is the cell at y = 64k + i - 1, so the neighbour
+				// below is the next bit down, carried in from the word before.
+				uint64_t n[8];
+				int i = 0;
+				for (int r=0 ; r<3 ; r++)
+				{
+					uint64_t w = rows[r][k];
+					uint64_t before = (k > 0) ? rows[r][k - 1] : 0;
+					uint64_t after = (k + 1 < wordsPerRow) ? rows[r][k + 1] : 0;
+					n[i++] = (w << 1) | (before >> 63);
+					if (r != 1)
+					{
+						n[i++] = w;
+					}
+					n[i++] = (w >> 1) | (after << 63);
+				}
+				// Count them with a tree of adders, giving the count as four
+				// bit planes.
+				uint64_t s0, s1, s2, c0, c1, c2, c3, c4, c5, c6, t;
+				uint64_t count[4];
+				fullAdder(n[0], n[1], n[2], s0, c0);
+				fullAdder(n[3], n[4], n[5], s1, c1);
+				halfAdder(n[6], n[7], s2, c2);
+				fullAdder(s0, s1, s2, count[0], c3);
+				fullAdder(c0, c1, c2, t, c4);
+				halfAdder(t, c3, count[1], c5);
+				halfAdder(c4, c5, count[2], c6);
+				count[3] = c6;
+				// Apply the rule.
+				uint64_t v = rows[1][k];
+				uint64_t result = 0;
+				for (auto &term : terms)
+				{
+					uint64_t match = (~v & term.whenZero) | (v & term.whenOne);
+					for (int bit=0 ; bit<4 ; bit++)
+					{
+						match &= ~(count[bit] ^ term.count[bit]);
+					}
+					result |= match;
+				}
+				out[k] = result;
+			}
+		}
+	});
+	std::swap(current, next);
+}
+
+}  // namespace BitSlice
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_BITSLICE_H_INCLUDED
+#define CELLATOM_BITSLICE_H_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include "grid.hh"
+#include "threadpool.hh"
+
+namespace AST
+{
+	struct StatementList;
+}
+
+/**
+ * A bit-sliced engine for two-state kernels.  Each cell is stored as a single
+ * bit, 64 to a word, and the neighbours of 64 cells are counted at once with
+ * bitwise full adders.  This is the classic bitboard technique for Life,
+ * applied to any kernel that it can be proven to be equivalent to.
+ */
+namespace BitSlice
+{
+	/**
+	 * An outer-totalistic rule, where the next value of a cell depends only
+	 * on its current value and the number of neighbours with the value 1.
+	 */
+	struct Rule
+	{
+		/**
+		 * The neighbour counts (as bits) for which a cell with the value 0
+		 * becomes 1.
+		 */
+		uint16_t born = 0;
+		/**
+		 * The neighbour counts (as bits) for which a cell with the value 1
+		 * stays 1.
+		 */
+		uint16_t survive = 0;
+	};
+
+	/**
+	 * Determine whether a kernel is a two-state, outer-totalistic rule with
+	 * the specified boundary mode, and if so, find the rule.  This runs the
+	 * kernel (using the interpreter) on every possible neighbourhood of
+	 * zeroes and ones, so it is exact: if it returns true, then a grid that
+	 * only contains zeroes and ones always will, and the rule gives the same
+	 * results as the kernel.
+	 */
+	bool analyse(AST::StatementList *ast,
+	             Grid::Boundary boundary,
+	             int16_t edgeValue,
+	             Rule &rule);
+
+	/**
+	 * Returns true if every cell in a grid is zero or one.
+	 */
+	bool isTwoState(const int16_t *grid,
+	                Grid::Coordinate width,
+	                Grid::Coordinate height);
+
+	/**
+	 * A grid with one bit per cell.  Like other grids, it has a halo, and
+	 * it is double buffered.
+	 */
+	class BitGrid
+	{
+		public:
+		/**
+		 * Construct a grid with the specified dimensions and boundary mode.
+		 */
+		BitGrid(Grid::Coordinate width,
+		        Grid::Coordinate height,
+		        Grid::Boundary boundary,
+		        int16_t edgeValue);
+		/**
+		 * Set the contents of the grid from a grid of zeroes and ones.
+		 */
+		void load(const int16_t *grid);
+		/**
+		 * Copy the contents of the grid to a grid with the same dimensions.
+		 */
+		void store(int16_t *grid);
+		/**
+		 * Run one generation, dividing the rows between the threads in the
+		 * pool.
+		 */
+		void step(const Rule &rule, ThreadPool &pool);
+		private:
+		/**
+		 * Fill in the bits in the halo.
+		 */
+		void fillHalo();
+		/**
+		 * Returns the first word of row x in the current grid.
+		 */
+		uint64_t *row(Grid::Coordinate x)
+		{
+			return &current[(x + 1) * wordsPerRow];
+		}
+		/** The width of the grid */
+		Grid::Coordinate width;
+		/** The height of the grid */
+		Grid::Coordinate height;
+		/** How the neighbourhoods of cells at the edges are treated */
+		Grid::Boundary boundary;
+		/** The value of the halo for constant boundaries */
+		int16_t edgeValue;
+		/**
+		 * The number of words in each row, including a bit for each end of
+		 * the row in the halo.
+		 */
+		int wordsPerRow;
+		/** The current generation */
+		std::vector<uint64_t> current;
+		/** The next generation */
+		std::vector<uint64_t> next;
+	};
+}
+
+#endif // CELLATOM_BITSLICE_H_INCLUDED
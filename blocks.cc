@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "blocks.hh"
+#include <algorithm>
+#include <assert.h>
+
+template<typename Cell>
+BlockedGrid<Cell>::BlockedGrid(Grid::Coordinate w, Grid::Coordinate h,
+                               int16_t size,
+                               int16_t ringDepth, Grid::Boundary b,
+                               int16_t value, int threadCount)
+	: width(w), height(h), blockSize(size), depth(ringDepth),
+	  blocksY((h + size - 1) / size), boundary(b), edgeValue(value),
+	  blockCells(Grid::size(size + 2*ringDepth, size + 2*ringDepth)),
+	  current(0), threads(threadCount)
+{
+	// With truncated neighbourhoods, there is nothing beyond the edges of the
+	// grid to put in the ring, so it stops at the edges.
+	bool truncate = (boundary == Grid::Boundary::Truncate);
+	auto ring = [&](Grid::Coordinate available)
+	{
+		return truncate ? std::min<Grid::Coordinate>(depth, available) : depth;
+	};
+	for (Grid::Coordinate x=0 ; x<width ; x+=blockSize)
+	{
+		for (Grid::Coordinate y=0 ; y<height ; y+=blockSize)
+		{
+			Block block;
+			block.x = x;
+			block.y = y;
+			int cellsX = std::min<Grid::Coordinate>(blockSize, width - x);
+			int cellsY = std::min<Grid::Coordinate>(blockSize, height - y);
+			block.xStart = ring(x);
+			block.yStart = ring(y);
+			block.xEnd = block.xStart + cellsX;
+			block.yEnd = block.yStart + cellsY;
+			block.width = block.xEnd + ring(width - x - cellsX);
+			block.height = block.yEnd + ring(height - y - cellsY);
+			blocks.push_back(block);
+		}
+	}
+	cells[0].resize(blocks.size() * blockCells);
+	cells[1].resize(blocks.size() * blockCells);
+	if (depth > 1)
+	{
+		scratch.resize(2 * threads * blockCells);
+	}
+}
+
+template<typename Cell>
+void BlockedGrid<Cell>::load(const Cell *grid)
+{
+	for (size_t i=0 ; i<blocks.size() ; i++)
+	{
+		const Block &b = blocks[i];
+		Cell *small = blockGrid(i, 0);
+		for (int x=b.xStart ; x<b.xEnd ; x++)
+		{
+			std::copy_n(grid + Grid::index(height, b.x + x - b.xStart, b.y),
+			            b.yEnd - b.yStart,
+			            small + Grid::index(b.height, x, b.yStart));
+		}
+	}
+}
+
+template<typename Cell>
+void BlockedGrid<Cell>::store(Cell *grid) const
+{
+	for (size_t i=0 ; i<blocks.size() ; i++)
+	{
+		const Block &b = blocks[i];
+		const Cell *small = &cells[current][i * blockCells];
+		for (int x=b.xStart ; x<b.xEnd ; x++)
+		{
+			std::copy_n(small + Grid::index(b.height, x, b.yStart),
+			            b.yEnd - b.yStart,
+			            grid + Grid::index(height, b.x + x - b.xStart, b.y));
+		}
+	}
+}
+
+template<typename Cell>
+void BlockedGrid<Cell>::copyRun(Cell *dst,
+                                Grid::Coordinate x,
+                                Grid::Coordinate y,
+                                int count)
+{
+	// Truncated grids have no ring beyond the edges, so coordinates are only
+	// out of range for the other modes.
+	bool constant = (boundary == Grid::Boundary::Constant);
+	if (x < 0 || x >= width)
+	{
+		if (constant)
+		{
+			std::fill_n(dst, count, edgeValue);
+			return;
+		}
+		x = ((x % width) + width) % width;
+	}
+	while (count > 0)
+	{
+		if (y < 0 || y >= height)
+		{
+			if (constant)
+			{
+				*(dst++) = edgeValue;
+				y++;
+				count--;
+				continue;
+			}
+			y = ((y % height) + height) % height;
+		}
+		// Copy as much as possible from the block that contains (x, y).
+		size_t i = (x / blockSize) * blocksY + (y / blockSize);
+		const Block &b = blocks[i];
+		int n = std::min<Grid::Coordinate>(count,
+		                                   b.y + (b.yEnd - b.yStart) - y);
+		std::copy_n(blockGrid(i, 0) + Grid::index(b.height,
+		                                          x - b.x + b.xStart,
+		                                          y - b.y + b.yStart),
+		            n, dst);
+		dst += n;
+		y += n;
+		count -= n;
+	}
+}
+
+template<typename Cell>
+void BlockedGrid<Cell>::fillRing(int i)
+{
+	const Block &b = blocks[i];
+	Cell *small = blockGrid(i, 0);
+	// The offsets from coordinates in the small grid to the whole grid.
+	Grid::Coordinate dx = b.x - b.xStart;
+	Grid::Coordinate dy = b.y - b.yStart;
+	for (int x=0 ; x<b.width ; x++)
+	{
+		Cell *row = small + Grid::index(b.height, x, 0);
+		if (x < b.xStart || x >= b.xEnd)
+		{
+			copyRun(row, x + dx, dy, b.height);
+			continue;
+		}
+		// Rows through the block only need the ends.
+		copyRun(row, x + dx, dy, b.yStart);
+		copyRun(row + b.yEnd, x + dx, b.yEnd + dy, b.height - b.yEnd);
+	}
+}
+
+template<typename Cell>
+void BlockedGrid<Cell>::step(ThreadPool &pool,
+                             const Kernel &kernel,
+                             int generations)
+{
+	// The cells of the blocks in the current generation aren't modified until
+	// every block has been computed, so each thread can refresh the rings of
+	// its own blocks without waiting for the others.
+	assert(pool.size() <= threads);
+	assert(generations <= depth);
+	int bands = pool.size();
+	bool wrap = (boundary == Grid::Boundary::Wrap);
+	bool constant = (boundary == Grid::Boundary::Constant);
+	pool.run([&](int band) {
+		// The generations before the last are kept in this thread's scratch
+		// grids, so that the blocks' cells are only written once.
+		Cell *scratchGrids[2] = { nullptr, nullptr };
+		if (generations > 1)
+		{
+			scratchGrids[0] = &scratch[2 * band * blockCells];
+			scratchGrids[1] = scratchGrids[0] + blockCells;
+		}
+		size_t end = blocks.size() * (band + 1) / bands;
+		for (size_t i = blocks.size() * band / bands ; i<end ; i++)
+		{
+			const Block &b = blocks[i];
+			fillRing(i);
+			Cell *oldgrid = blockGrid(i, 0);
+			// The part of the small grid that holds cells of the grid (rather
+			// than the constant edge).
+			int xMin = wrap ? 0 : std::max<Grid::Coordinate>(0, b.xStart - b.x);
+			int xMax = wrap ? b.width :
+				std::min<Grid::Coordinate>(b.width, b.xStart - b.x + width);
+			int yMin = wrap ? 0 : std::max<Grid::Coordinate>(0, b.yStart - b.y);
+			int yMax = wrap ? b.height :
+				std::min<Grid::Coordinate>(b.height, b.yStart - b.y + height);
+			// The cells of the ring that are beyond the edges of a grid
+			// with constant edges are never computed, so the scratch grids
+			// need them too.
+			bool edge = (xMin > 0) || (xMax < b.width) ||
+			            (yMin > 0) || (yMax < b.height);
+			if (constant && edge && generations > 1)
+			{
+				std::copy_n(oldgrid, blockCells, scratchGrids[0]);
+				std::copy_n(oldgrid, blockCells, scratchGrids[1]);
+			}
+			for (int g=1 ; g<=generations ; g++)
+			{
+				// Each generation computes a ring fewer than the last, ending
+				// with just the block's own cells, which only depend on the
+				// cells that were computed in the generation before.
+				int extend = generations - g;
+				Cell *newgrid = (g == generations) ? blockGrid(i, 1) :
+				                scratchGrids[g & 1];
+				kernel(oldgrid, newgrid, b.width, b.height,
+				       std::max(xMin, b.xStart - extend),
+				       std::min(xMax, b.xEnd + extend),
+				       std::max(yMin, b.yStart - extend),
+				       std::min(yMax, b.yEnd + extend));
+				oldgrid = newgrid;
+			}
+		}
+	});
+	current ^= 1;
+}
+
+template class BlockedGrid<int16_t>;
+template class BlockedGrid<int8_t>;
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_BLOCKS_H_INCLUDED
+#define CELLATOM_BLOCKS_H_INCLUDED
+#include <functional>
+#include <stdint.h>
+#include <vector>
+#include "grid.hh"
+#include "threadpool.hh"
+
+/**
+ * A grid stored as square blocks, each of which is contiguous in memory.  In
+ * the normal layout, the three rows that each cell reads its neighbours from
+ * are a whole row apart, so for tall grids they don't all stay in the cache.
+ * Here, each block is stored as a small grid (in the normal layout, see
+ * grid.hh) that contains the cells of the block and a ring of copies of the
+ * cells around it, so all of the neighbours of the cells in a block are close
+ * together.
+ *
+ * Before a block is computed, its ring is refreshed from the blocks around it
+ * (or from the other side of the grid, or the edge value, depending on the
+ * boundary mode).  With truncated neighbourhoods, the ring is left out on the
+ * sides of blocks at the edges of the grid, so the engine truncates the
+ * neighbourhoods at the same places.  Each block is then computed by running
+ * the engine on its small grid, for just the cells of the block.
+ *
+ * Each call to the engine has its own global registers, so this is only valid
+ * for kernels whose registers don't depend on the order of the cells.  Grids
+ * are converted to and from the normal layout with `load` and `store`.
+ *
+ * The ring can be several cells deep, which allows several generations of a
+ * block to be computed while it is in the cache.  Each generation computes the
+ * part of the ring that the next one needs, so the ring only has to be
+ * refreshed (and the block's cells written back) once for all of them.
+ */
+template<typename Cell>
+class BlockedGrid
+{
+	public:
+	/**
+	 * A function that runs one generation of the cells with x in [xStart,
+	 * xEnd) and y in [yStart, yEnd) of a grid.  This has the same arguments
+	 * as `Interpreter::runOneStep`, `Bytecode::runOneStep` and the compiled
+	 * automaton.
+	 */
+	typedef std::function<void(Cell *oldgrid,
+	                           Cell *newgrid,
+	                           Grid::Coordinate width,
+	                           Grid::Coordinate height,
+	                           Grid::Coordinate xStart,
+	                           Grid::Coordinate xEnd,
+	                           Grid::Coordinate yStart,
+	                           Grid::Coordinate yEnd)> Kernel;
+	/**
+	 * Construct an empty grid of `width` by `height` cells, stored in blocks
+	 * of `blockSize` by `blockSize` cells, with rings `depth` cells deep.  For
+	 * constant boundaries, the neighbours beyond the edges have the value
+	 * `edgeValue`.  The grid is computed by pools of at most `threads`
+	 * threads.
+	 */
+	BlockedGrid(Grid::Coordinate width,
+	            Grid::Coordinate height,
+	            int16_t blockSize,
+	            int16_t depth,
+	            Grid::Boundary boundary,
+	            int16_t edgeValue,
+	            int threads);
+	/**
+	 * Copies the cells from a grid in the normal layout.
+	 */
+	void load(const Cell *grid);
+	/**
+	 * Copies the cells to a grid in the normal layout.  The halo of the
+	 * destination is not modified.
+	 */
+	void store(Cell *grid) const;
+	/**
+	 * Run `generations` generations, which must be no more than the depth of
+	 * the rings, using `kernel` to compute each block.  The blocks are
+	 * divided between the threads in the pool.
+	 */
+	void step(ThreadPool &pool, const Kernel &kernel, int generations);
+	private:
+	/**
+	 * The position of a block in the grid, and the shape of the small grid
+	 * that stores it.
+	 */
+	struct Block
+	{
+		/** The x coordinate (in the whole grid) of the first cell */
+		Grid::Coordinate x;
+		/** The y coordinate (in the whole grid) of the first cell */
+		Grid::Coordinate y;
+		/** The width of the small grid, including the ring */
+		int16_t width;
+		/** The height of the small grid, including the ring */
+		int16_t height;
+		/** The first x coordinate of the block's own cells in the small grid */
+		int16_t xStart;
+		/** The end of the block's own cells in the x direction */
+		int16_t xEnd;
+		/** The first y coordinate of the block's own cells in the small grid */
+		int16_t yStart;
+		/** The end of the block's own cells in the y direction */
+		int16_t yEnd;
+	};
+	/**
+	 * Returns the small grid for block `i` in the current (`which` is zero)
+	 * or next generation.
+	 */
+	Cell *blockGrid(int i, int which)
+	{
+		return &cells[(current ^ which) & 1][i * blockCells];
+	}
+	/**
+	 * Copies `count` cells of the whole grid in the current generation,
+	 * starting at (x, y) and continuing in the y direction, to `dst`.  The
+	 * coordinates may be beyond the edges of the grid.
+	 */
+	void copyRun(Cell *dst, Grid::Coordinate x, Grid::Coordinate y,
+	             int count);
+	/**
+	 * Copies the current values of the cells around block `i` into its
+	 * ring.
+	 */
+	void fillRing(int i);
+	/** The width of the grid */
+	Grid::Coordinate width;
+	/** The height of the grid */
+	Grid::Coordinate height;
+	/** The length of the sides of each block */
+	int16_t blockSize;
+	/** The depth of the rings */
+	int16_t depth;
+	/** The number of blocks in the y direction */
+	int blocksY;
+	/** The boundary mode */
+	Grid::Boundary boundary;
+	/** The value of neighbours beyond the edges for constant boundaries */
+	Cell edgeValue;
+	/** The number of cells allocated for each block's small grid */
+	size_t blockCells;
+	/** The blocks, indexed by x block and then y block */
+	std::vector<Block> blocks;
+	/** The current and next generations */
+	std::vector<Cell> cells[2];
+	/** Which of `cells` holds the current generation */
+	int current;
+	/** The number of threads that `scratch` has room for */
+	int threads;
+	/**
+	 * Two small grids for each thread, which hold the generations of a
+	 * block before the last when several are computed at once.
+	 */
+	std::vector<Cell> scratch;
+};
+
+#endif // CELLATOM_BLOCKS_H_INCLUDED
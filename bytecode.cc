@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ast.hh"
+#include "bytecode.hh"
+#include <algorithm>
+#include <string.h>
+
+using namespace AST;
+
+namespace Bytecode {
+/**
+ * The state for the bytecode compiler.
+ */
+struct State
+{
+	/** The program being generated */
+	Program &program;
+	/** The instructions currently being generated */
+	std::vector<Instruction> *code;
+	/** Whether we are generating the version for cells away from the edges */
+	bool interior;
+	/**
+	 * The register that currently holds the value of a0.  Inside unrolled
+	 * neighbours statements that do not assign to a0, and after them until
+	 * the next assignment to a0, this is a neighbour register, so the
+	 * neighbour does not need to be copied.
+	 */
+	uint16_t a0 = LocalBase;
+	/**
+	 * The register that the next range expression should store its result in,
+	 * or -1 if it should allocate a temporary.
+	 */
+	int destination = -1;
+	/**
+	 * The index of the most recent instruction that may be the target of a
+	 * jump.  Instructions can't be merged across this.
+	 */
+	size_t label = 0;
+	/**
+	 * The next free temporary register.  Temporaries are allocated like a
+	 * stack: an expression's result is consumed as soon as it is produced.
+	 */
+	unsigned nextTemporary = FirstTemporary;
+
+	State(Program &p) : program(p) {}
+
+	/**
+	 * Appends an instruction and returns its index.
+	 */
+	size_t emit(Opcode op, uint16_t reg, uint16_t operand)
+	{
+		size_t index = code->size();
+		if (index >= UINT16_MAX)
+		{
+			program.error = "Program is too large to compile to bytecode";
+		}
+		code->push_back({op, static_cast<uint8_t>(reg), 0, operand});
+		return index;
+	}
+	/**
+	 * Appends an operation that has register and immediate variants.  The
+	 * `op` argument is the register variant.
+	 */
+	void emit(Opcode op, uint16_t reg, Operand operand)
+	{
+		// Moving a register to itself is a no-op.
+		if (op == Move && operand.isRegister && operand.value == reg)
+		{
+			return;
+		}
+		if (!operand.isRegister)
+		{
+			op = static_cast<Opcode>(op + 1);
+		}
+		// Merge consecutive additions of constants to the same register,
+		// which are common in unrolled neighbours statements.
+		if ((op == AddImmediate) && (code->size() > label) &&
+		    (code->back().op == AddImmediate) && (code->back().reg == reg))
+		{
+			code->back().operand += operand.value;
+			return;
+		}
+		emit(op, reg, operand.value);
+	}
+	/**
+	 * Returns the index of the next instruction, for use as a jump target.
+	 */
+	uint16_t target()
+	{
+		label = code->size();
+		return label;
+	}
+	/**
+	 * Allocates a new temporary register.
+	 */
+	uint16_t allocateTemporary()
+	{
+		if (nextTemporary >= RegisterCount)
+		{
+			program.error = "Range expressions nested too deeply to compile to bytecode";
+			return RegisterCount - 1;
+		}
+		return nextTemporary++;
+	}
+};
+
+Program compile(AST::StatementList *ast, Grid::Boundary boundary)
+{
+	Program p;
+	State s(p);
+	s.code = &p.interior;
+	s.interior = true;
+	ast->compile(s);
+	p.truncate = (boundary == Grid::Boundary::Truncate);
+	if (!p.truncate)
+	{
+		return p;
+	}
+	s.code = &p.border;
+	s.interior = false;
+	s.label = 0;
+	// The interior code may finish with a0 aliased to a neighbour register,
+	// which the border code does not load.
+	s.a0 = LocalBase;
+	ast->compile(s);
+	return p;
+}
+
+namespace {
+/**
+ * The state of the virtual machine while running a program over a band of the
+ * grid.
+ */
+struct Machine
+{
+	/** The registers */
+	uint16_t r[RegisterCount];
+	/** The start of the code currently being run */
+	const Instruction *code;
+	/** The start of the program's range tables */
+	const RangeEntry *ranges;
+	/** The start of the program's dense tables */
+	const uint16_t *lookups;
+	/**
+	 * A bitmap of the neighbours that exist.  Only used at the edges of the
+	 * grid.
+	 */
+	unsigned neighbours;
+
+	/**
+	 * Returns the entry for `input` in a dense table.
+	 */
+	static uint16_t lookup(uint16_t input, const uint16_t *table)
+	{
+		// Values below the first wrap around to large indexes, so one
+		// comparison finds every value outside the table.
+		uint16_t index = input - table[0];
+		uint16_t count = table[1];
+		return table[2 + std::min(index, count)];
+	}
+
+	/**
+	 * Run the instructions in the range [code, end).
+	 */
+	void run(const Instruction *start, const Instruction *end)
+	{
+		code = start;
+		const Instruction *pc = start;
+		while (pc != end)
+		{
+			const Instruction &i = *(pc++);
+			switch (i.op)
+			{
+				case Add:
+					r[i.reg] += r[i.operand];
+					break;
+				case AddImmediate:
+					r[i.reg] += i.operand;
+					break;
+				case Sub:
+					r[i.reg] -= r[i.operand];
+					break;
+				case SubImmediate:
+					r[i.reg] -= i.operand;
+					break;
+				case Mul:
+					r[i.reg] *= r[i.operand];
+					break;
+				case MulImmediate:
+					r[i.reg] *= i.operand;
+					break;
+				case Div:
+					r[i.reg] /= r[i.operand];
+					break;
+				case DivImmediate:
+					r[i.reg] /= i.operand;
+					break;
+				case Min:
+					r[i.reg] = std::min(r[i.reg], r[i.operand]);
+					break;
+				case MinImmediate:
+					r[i.reg] = std::min(r[i.reg], i.operand);
+					break;
+				case Max:
+					r[i.reg] = std::max(r[i.reg], r[i.operand]);
+					break;
+				case MaxImmediate:
+					r[i.reg] = std::max(r[i.reg], i.operand);
+					break;
+				case Move:
+					r[i.reg] = r[i.operand];
+					break;
+				case MoveImmediate:
+					r[i.reg] = i.operand;
+					break;
+				case Range:
+				{
+					uint16_t input = r[i.input];
+					const RangeEntry *e = ranges + i.operand;
+					// The terminating entry matches nothing, but jumps to the
+					// default case.
+					for ( ; e->start <= e->end ; e++)
+					{
+						if ((input >= e->start) && (input <= e->end))
+						{
+							break;
+						}
+					}
+					pc = code + e->target;
+					break;
+				}
+				case RangeValue:
+				{
+					uint16_t input = r[i.input];
+					const RangeEntry *e = ranges + i.operand;
+					for ( ; e->start <= e->end ; e++)
+					{
+						if ((input >= e->start) && (input <= e->end))
+						{
+							break;
+						}
+					}
+					r[i.reg] = e->target;
+					break;
+				}
+				case Lookup:
+				{
+					pc = code + lookup(r[i.input], lookups + i.operand);
+					break;
+				}
+				case LookupValue:
+				{
+					r[i.reg] = lookup(r[i.input], lookups + i.operand);
+					break;
+				}
+				case Jump:
+					pc = code + i.operand;
+					break;
+				case Neighbour:
+					if (neighbours & (1 << i.reg))
+					{
+						r[LocalBase] = r[NeighbourBase + i.reg];
+					}
+					else
+					{
+						pc = code + i.operand;
+					}
+					break;
+				case AddNeighbours:
+					r[i.reg] += r[NeighbourBase] + r[NeighbourBase+1] +
+					            r[NeighbourBase+2] + r[NeighbourBase+3] +
+					            r[NeighbourBase+4] + r[NeighbourBase+5] +
+					            r[NeighbourBase+6] + r[NeighbourBase+7];
+					break;
+			}
+		}
+	}
+};
+}
+
+void runOneStep(int16_t *oldgrid,
+                int16_t *newgrid,
+                Grid::Coordinate width,
+                Grid::Coordinate height,
+                Grid::Coordinate xStart,
+                Grid::Coordinate xEnd,
+                Grid::Coordinate yStart,
+                Grid::Coordinate yEnd,
+                const Program &program)
+{
+	Machine m;
+	m.ranges = program.ranges.data();
+	m.lookups = program.lookups.data();
+	const Instruction *interior = program.interior.data();
+	const Instruction *interiorEnd = interior + program.interior.size();
+	const Instruction *border = program.border.data();
+	const Instruction *borderEnd = border + program.border.size();
+	bzero(m.r + GlobalBase, 10 * sizeof(uint16_t));
+	Grid::Coordinate stride = Grid::stride(height);
+	for (Grid::Coordinate x=xStart ; x<xEnd ; x++)
+	{
+		Grid::Coordinate i = Grid::index(height, x, yStart);
+		for (Grid::Coordinate y=yStart ; y<yEnd ; y++,i++)
+		{
+			bzero(m.r + LocalBase, 10 * sizeof(uint16_t));
+			m.r[VRegister] = oldgrid[i];
+			bool isInterior = !program.truncate ||
+			                  ((x > 0) && (x < width-1) &&
+			                   (y > 0) && (y < height-1));
+			// Load the neighbours in the order that the neighbours statement
+			// visits them.  At the edges, record which ones exist.  Away from
+			// the edges, or if the halo is in use, they all do.
+			if (program.usesNeighbours && isInterior)
+			{
+				const int16_t *left = oldgrid + i - stride;
+				const int16_t *right = oldgrid + i + stride;
+				m.r[NeighbourBase]   = left[-1];
+				m.r[NeighbourBase+1] = left[0];
+				m.r[NeighbourBase+2] = left[1];
+				m.r[NeighbourBase+3] = oldgrid[i-1];
+				m.r[NeighbourBase+4] = oldgrid[i+1];
+				m.r[NeighbourBase+5] = right[-1];
+				m.r[NeighbourBase+6] = right[0];
+				m.r[NeighbourBase+7] = right[1];
+			}
+			else if (program.usesNeighbours)
+			{
+				int n = 0;
+				m.neighbours = 0;
+				for (Grid::Coordinate nx = x - 1 ; nx <= x + 1 ; nx++)
+				{
+					for (Grid::Coordinate ny = y - 1 ; ny <= y + 1 ; ny++)
+					{
+						if (nx == x && ny == y) { continue; }
+						if ((nx >= 0) && (nx < width) && (ny >= 0) && (ny < height))
+						{
+							m.r[NeighbourBase + n] = oldgrid[Grid::index(height, nx, ny)];
+							m.neighbours |= 1 << n;
+						}
+						n++;
+					}
+				}
+			}
+			if (isInterior)
+			{
+				m.run(interior, interiorEnd);
+			}
+			else
+			{
+				m.run(border, borderEnd);
+			}
+			newgrid[i] = m.r[VRegister];
+		}
+	}
+}
+
+}  // namespace Bytecode
+
+Bytecode::Operand Literal::compile(Bytecode::State &)
+{
+	return { false, value };
+}
+Bytecode::Operand LocalRegister::compile(Bytecode::State &s)
+{
+	assert(registerNumber >= 0 && registerNumber < 10);
+	if (registerNumber == 0)
+	{
+		return { true, s.a0 };
+	}
+	return { true, static_cast<uint16_t>(Bytecode::LocalBase + registerNumber) };
+}
+Bytecode::Operand GlobalRegister::compile(Bytecode::State &)
+{
+	assert(registerNumber >= 0 && registerNumber < 10);
+	return { true, static_cast<uint16_t>(Bytecode::GlobalBase + registerNumber) };
+}
+Bytecode::Operand VRegister::compile(Bytecode::State &)
+{
+	return { true, Bytecode::VRegister };
+}
+
+Bytecode::Operand Arithmetic::compile(Bytecode::State &s)
+{
+	unsigned temporaries = s.nextTemporary;
+	Bytecode::Operand o = target->compile(s);
+	// If a0 is currently an alias for a neighbour register, copy the neighbour
+	// into the real a0 before modifying it.
+	if ((o.value == s.a0) && (s.a0 != Bytecode::LocalBase))
+	{
+		s.emit(Bytecode::Move, Bytecode::LocalBase, s.a0);
+		s.a0 = o.value = Bytecode::LocalBase;
+	}
+	// A range expression that is simply assigned to a register can store its
+	// result there directly.
+	if (op.op == Op::Assign)
+	{
+		s.destination = o.value;
+	}
+	Bytecode::Operand v = value->compile(s);
+	s.destination = -1;
+	Bytecode::Opcode opcode = Bytecode::Move;
+	switch (op.op)
+	{
+		case Op::Add:
+			opcode = Bytecode::Add;
+			break;
+		case Op::Assign:
+			opcode = Bytecode::Move;
+			break;
+		case Op::Sub:
+			opcode = Bytecode::Sub;
+			break;
+		case Op::Mul:
+			opcode = Bytecode::Mul;
+			break;
+		case Op::Div:
+			opcode = Bytecode::Div;
+			break;
+		case Op::Min:
+			opcode = Bytecode::Min;
+			break;
+		case Op::Max:
+			opcode = Bytecode::Max;
+			break;
+	}
+	s.emit(opcode, o.value, v);
+	// Any temporary used for the value is dead now.
+	s.nextTemporary = temporaries;
+	return o;
+}
+
+/**
+ * The largest number of values that a range expression can cover and still
+ * be compiled to a dense table.
+ */
+static const int MaxLookup = 256;
+
+Bytecode::Operand RangeExpr::compile(Bytecode::State &s)
+{
+	std::vector<Bytecode::Instruction> &code = *s.code;
+	Bytecode::Program &p = s.program;
+	uint16_t result = (s.destination < 0) ? s.allocateTemporary() :
+	                                        s.destination;
+	s.destination = -1;
+	Bytecode::Operand input = value->compile(s);
+	bool literals = true;
+	for (auto &range : ranges)
+	{
+		literals &= (dynamic_cast<Literal*>(range->value.get()) != nullptr);
+	}
+	size_t lookup = s.emit(literals ? Bytecode::RangeValue : Bytecode::Range,
+	                       result, 0);
+	code[lookup].input = input.value;
+	unsigned temporaries = s.nextTemporary;
+	// The values may contain range expressions with their own tables, so
+	// collect this one separately and then add it all at once.
+	std::vector<Bytecode::RangeEntry> table;
+	std::vector<size_t> jumps;
+	for (auto &range : ranges)
+	{
+		uint16_t end = range->end->value;
+		uint16_t start = range->start.get() ? range->start->value : end;
+		// Empty ranges can never match.
+		if (start > end)
+		{
+			continue;
+		}
+		// If every value is a literal, then the table can hold the values
+		// and there is no need for any code for the cases.
+		if (literals)
+		{
+			Literal *l = static_cast<Literal*>(range->value.get());
+			table.push_back({start, end, l->value});
+			continue;
+		}
+		table.push_back({start, end, s.target()});
+		// Nested range expressions can write directly to our result.
+		s.destination = result;
+		s.emit(Bytecode::Move, result, range->value->compile(s));
+		s.destination = -1;
+		s.nextTemporary = temporaries;
+		jumps.push_back(s.emit(Bytecode::Jump, 0, 0));
+	}
+	// If nothing matches, then the result is zero.
+	if (literals)
+	{
+		table.push_back({1, 0, 0});
+	}
+	else
+	{
+		table.push_back({1, 0, s.target()});
+		s.emit(Bytecode::MoveImmediate, result, 0);
+	}
+	uint16_t end = s.target();
+	for (size_t jump : jumps)
+	{
+		code[jump].operand = end;
+	}
+	// If the ranges only cover a few values, then turn the table into one
+	// with an entry for each value, so that the lookup doesn't have to test
+	// the ranges one at a time.  Earlier ranges win, so fill it backwards.
+	uint16_t low = UINT16_MAX;
+	uint16_t high = 0;
+	for (size_t i=0 ; i+1<table.size() ; i++)
+	{
+		low = std::min(low, table[i].start);
+		high = std::max(high, table[i].end);
+	}
+	if ((table.size() > 2) && (high - low < MaxLookup))
+	{
+		uint16_t count = high - low + 1;
+		std::vector<uint16_t> dense(count + 3, table.back().target);
+		dense[0] = low;
+		dense[1] = count;
+		for (size_t i=table.size()-1 ; i-->0 ; )
+		{
+			for (unsigned v=table[i].start ; v<=table[i].end ; v++)
+			{
+				dense[2 + v - low] = table[i].target;
+			}
+		}
+		code[lookup].op = literals ? Bytecode::LookupValue : Bytecode::Lookup;
+		code[lookup].operand = p.lookups.size();
+		p.lookups.insert(p.lookups.end(), dense.begin(), dense.end());
+	}
+	else
+	{
+		code[lookup].operand = p.ranges.size();
+		p.ranges.insert(p.ranges.end(), table.begin(), table.end());
+	}
+	if ((p.ranges.size() > UINT16_MAX) || (p.lookups.size() > UINT16_MAX))
+	{
+		p.error = "Program is too large to compile to bytecode";
+	}
+	return { true, result };
+}
+
+Bytecode::Operand Neighbours::compile(Bytecode::State &s)
+{
+	std::vector<Bytecode::Instruction> &code = *s.code;
+	s.program.usesNeighbours = true;
+	// Away from the edges, every neighbour exists.  If the statements don't
+	// assign to a0, then they can read each neighbour register directly.
+	bool alias = s.interior && !Analysis::assignsLocal(statements.get(), 0);
+	size_t start = code.size();
+	// Unroll the loop, emitting a copy of the statements for each neighbour.
+	for (int n=0 ; n<8 ; n++)
+	{
+		uint16_t neighbour = Bytecode::NeighbourBase + n;
+		if (!s.interior)
+		{
+			// At the edges, skip the statements for missing neighbours.
+			size_t skip = s.emit(Bytecode::Neighbour, n, 0);
+			statements->compile(s);
+			code[skip].operand = s.target();
+		}
+		else if (alias)
+		{
+			s.a0 = neighbour;
+			statements->compile(s);
+		}
+		else
+		{
+			s.emit(Bytecode::Move, Bytecode::LocalBase, neighbour);
+			s.a0 = Bytecode::LocalBase;
+			statements->compile(s);
+		}
+	}
+	// If each copy is just adding the neighbour to the same register, then
+	// replace them with a single instruction that adds all of them.
+	if (alias && (code.size() == start + 8))
+	{
+		uint8_t reg = code[start].reg;
+		bool sum = (reg < Bytecode::NeighbourBase);
+		for (int n=0 ; n<8 ; n++)
+		{
+			Bytecode::Instruction &i = code[start + n];
+			sum &= (i.op == Bytecode::Add) &&
+			       (i.operand == Bytecode::NeighbourBase + n) &&
+			       (i.reg == reg);
+		}
+		if (sum)
+		{
+			code.resize(start);
+			s.emit(Bytecode::AddNeighbours, reg, 0);
+		}
+	}
+	// After the loop, a0 holds the value of the last neighbour, so keep
+	// using that register for it until something assigns to a0.
+	if (alias)
+	{
+		s.a0 = Bytecode::NeighbourBase + 7;
+	}
+	return { false, 0 };
+}
+Bytecode::Operand StatementList::compile(Bytecode::State &s)
+{
+	for (auto &st : statements)
+	{
+		st->compile(s);
+	}
+	return { false, 0 };
+}
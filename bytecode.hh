@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_BYTECODE_H_INCLUDED
+#define CELLATOM_BYTECODE_H_INCLUDED
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "grid.hh"
+
+namespace AST
+{
+	struct StatementList;
+}
+
+/**
+ * A compact, register-based bytecode for CellAtom kernels.  This is an
+ * alternative to the AST interpreter that avoids a virtual call and a pointer
+ * chase for every node in the tree, for use when the JIT is not available.
+ */
+namespace Bytecode
+{
+	/**
+	 * Class encapsulating the bytecode compiler state.
+	 */
+	struct State;
+
+	/**
+	 * The layout of the register file.  All registers, including
+	 * temporaries, are addressed by their index in this file.
+	 */
+	enum RegisterFile
+	{
+		/** The first of the 10 local registers */
+		LocalBase = 0,
+		/** The `v` register */
+		VRegister = 10,
+		/** The first of the 10 global registers */
+		GlobalBase = 11,
+		/**
+		 * The first of the 8 neighbour registers.  These are loaded with the
+		 * values of the current cell's neighbours before the kernel runs.
+		 */
+		NeighbourBase = 21,
+		/** The first temporary register, used for range expression results */
+		FirstTemporary = 29,
+		/** The total number of registers */
+		RegisterCount = 256
+	};
+
+	/**
+	 * The bytecode operations.  Every arithmetic operation has a variant
+	 * taking a register operand, followed by one taking an immediate operand.
+	 */
+	enum Opcode : uint8_t
+	{
+		Add,
+		AddImmediate,
+		Sub,
+		SubImmediate,
+		Mul,
+		MulImmediate,
+		Div,
+		DivImmediate,
+		Min,
+		MinImmediate,
+		Max,
+		MaxImmediate,
+		Move,
+		MoveImmediate,
+		/**
+		 * Look up the value of `input` in the range table starting at
+		 * `operand` and jump to the target of the first matching entry.
+		 */
+		Range,
+		/**
+		 * Look up the value of `input` in the range table starting at
+		 * `operand` and store the value of the first matching entry in `reg`.
+		 * Used for range expressions where every value is a literal.
+		 */
+		RangeValue,
+		/**
+		 * Look up the value of `input` in the dense table starting at
+		 * `operand` and jump to the target for it.  Used for range
+		 * expressions that only cover a few values.
+		 */
+		Lookup,
+		/**
+		 * Look up the value of `input` in the dense table starting at
+		 * `operand` and store its value in `reg`.  Used for range
+		 * expressions that only cover a few values, all of them literals.
+		 */
+		LookupValue,
+		/**
+		 * Jump to the instruction at `operand`.
+		 */
+		Jump,
+		/**
+		 * If neighbour number `reg` exists, copy its value to a0, otherwise
+		 * jump to the instruction at `operand`.  Only used at the edges of
+		 * the grid.
+		 */
+		Neighbour,
+		/**
+		 * Add the values of all eight neighbours to `reg`.  This is the
+		 * unrolled form of the common `neighbours ( + aN a0 )` idiom.  Only
+		 * used away from the edges of the grid.
+		 */
+		AddNeighbours
+	};
+
+	/**
+	 * The result of compiling an expression: either a register or an
+	 * immediate value.
+	 */
+	struct Operand
+	{
+		/** Whether `value` is a register index or an immediate */
+		bool isRegister;
+		/** The register index or immediate value */
+		uint16_t value;
+	};
+
+	/**
+	 * A single bytecode instruction.
+	 */
+	struct Instruction
+	{
+		/** The operation to perform */
+		Opcode op;
+		/**
+		 * The register that is the target of the operation, or the neighbour
+		 * number.
+		 */
+		uint8_t reg;
+		/**
+		 * The register tested by range operations.
+		 */
+		uint8_t input;
+		/**
+		 * The source register or immediate value, range table index, or jump
+		 * target, depending on the operation.
+		 */
+		uint16_t operand;
+	};
+
+	/**
+	 * An entry in a range table.  Each table is a contiguous sequence of
+	 * entries, terminated by an entry whose start is greater than its end,
+	 * which is used for the default case.
+	 */
+	struct RangeEntry
+	{
+		/** The first value that matches this entry */
+		uint16_t start;
+		/** The last value that matches this entry */
+		uint16_t end;
+		/**
+		 * The index of the instruction to jump to on a match, or the value of
+		 * the expression for `RangeValue`.
+		 */
+		uint16_t target;
+	};
+
+	/**
+	 * A compiled kernel.  Neighbours statements are unrolled, so there are
+	 * two versions of the code: one for cells away from the edges of the
+	 * grid, where every neighbour exists and no checks are needed, and one
+	 * for the cells at the edges.  The second is only needed when
+	 * neighbourhoods are truncated, otherwise the halo provides every cell
+	 * with eight neighbours.
+	 */
+	struct Program
+	{
+		/** The instructions for cells away from the edges of the grid */
+		std::vector<Instruction> interior;
+		/**
+		 * The instructions for cells at the edges of the grid, if
+		 * neighbourhoods are truncated.
+		 */
+		std::vector<Instruction> border;
+		/** Whether neighbourhoods are truncated at the edges of the grid */
+		bool truncate = true;
+		/** All of the range tables used by the instructions */
+		std::vector<RangeEntry> ranges;
+		/**
+		 * All of the dense tables used by the instructions.  Each is the
+		 * first value that it covers, the number of values n, the target or
+		 * value for each of the n values and then the one for any other
+		 * value.
+		 */
+		std::vector<uint16_t> lookups;
+		/** Whether the neighbour registers need to be loaded */
+		bool usesNeighbours = false;
+		/**
+		 * Why the program can't be compiled to bytecode, or an empty string
+		 * if it can.  A program with an error must not be run.
+		 */
+		std::string error;
+	};
+
+	/**
+	 * Compile the AST to bytecode, using the specified boundary mode.  If
+	 * that isn't possible, then the returned program's `error` is set.
+	 */
+	Program compile(AST::StatementList *ast, Grid::Boundary boundary);
+
+	/**
+	 * Run a bytecode program for one iteration over the cells of a grid with
+	 * x in [xStart, xEnd) and y in [yStart, yEnd).  As with the AST
+	 * interpreter, each call has its own set of global registers, and the
+	 * halo of the old grid must have been filled in unless neighbourhoods are
+	 * truncated.
+	 */
+	void runOneStep(int16_t *oldgrid,
+	                int16_t *newgrid,
+	                Grid::Coordinate width,
+	                Grid::Coordinate height,
+	                Grid::Coordinate xStart,
+	                Grid::Coordinate xEnd,
+	                Grid::Coordinate yStart,
+	                Grid::Coordinate yEnd,
+	                const Program &program);
+}
+
+#endif // CELLATOM_BYTECODE_H_INCLUDED
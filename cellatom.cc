@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cellatom.h"
+#include "cellatom.hh"
+#include "parser.hh"
+#include "ast.hh"
+#include "bytecode.hh"
+#include "schedule.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sstream>
+
+using namespace CellAtom;
+
+/**
+ * Parses a program from an input.  Returns null, and sets `error` to a
+ * description of the problem, if it can't be parsed.
+ */
+template<typename Input>
+static std::shared_ptr<AST::StatementList> parseInput(Input &input,
+                                                      std::string &error)
+{
+	Parser::CellAtomParser p;
+	std::unique_ptr<AST::StatementList> ast;
+	error = "syntax error";
+	pegmatite::ErrorReporter err =
+		[&](const pegmatite::InputRange& r, const std::string& msg) {
+		std::ostringstream os;
+		os << "line " << r.start.line << ", col " << r.start.col << ": "
+		   << msg;
+		error = os.str();
+	};
+	if (!p.parse(input, p.g.statements, p.g.ignored, err, ast))
+	{
+		return nullptr;
+	}
+	error.clear();
+	return std::shared_ptr<AST::StatementList>(std::move(ast));
+}
+
+std::unique_ptr<Program> Program::parse(const std::string &source,
+                                        std::string &error)
+{
+	std::string text(source);
+	pegmatite::StringInput input(std::move(text));
+	std::shared_ptr<AST::StatementList> ast = parseInput(input, error);
+	if (!ast)
+	{
+		return nullptr;
+	}
+	return std::unique_ptr<Program>(new Program(ast));
+}
+
+std::unique_ptr<Program> Program::load(const std::string &fileName,
+                                       std::string &error)
+{
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		error = fileName + ": " + strerror(errno);
+		return nullptr;
+	}
+	std::shared_ptr<AST::StatementList> ast;
+	{
+		pegmatite::AsciiFileInput input(fd);
+		ast = parseInput(input, error);
+	}
+	close(fd);
+	if (!ast)
+	{
+		return nullptr;
+	}
+	return std::unique_ptr<Program>(new Program(ast));
+}
+
+bool Program::usesGlobals() const
+{
+	return Analysis::usesGlobals(ast.get());
+}
+
+struct Kernel::Impl
+{
+	/** The program, which the interpreter runs directly */
+	std::shared_ptr<AST::StatementList> ast;
+	/** The options that the kernel was created with */
+	Options options;
+	/**
+	 * Whether the program's global registers depend on the order of the
+	 * cells, which must then be computed in order on a single thread.
+	 */
+	bool orderDependent;
+	/** The program compiled to bytecode, for the bytecode engine */
+	Bytecode::Program bytecode;
+	/** The machine code, for the compiled engine */
+	std::unique_ptr<Compiler::Code> code;
+	/** The function that runs a generation over part of a grid */
+	BlockedGrid<int16_t>::Kernel run;
+	/** The threads that each generation is divided between */
+	ThreadPool pool;
+	Impl(const std::shared_ptr<AST::StatementList> &a, const Options &o)
+		: ast(a), options(o),
+		  orderDependent(Analysis::orderDependent(a.get())),
+		  pool(orderDependent ? 1 : o.threads) {}
+};
+
+Kernel::Kernel(std::unique_ptr<Impl> i) : impl(std::move(i)) {}
+
+/**
+ * Returns a description of the first invalid option, or an empty string if
+ * they are all valid.
+ */
+static std::string checkOptions(const Options &options)
+{
+	if (options.optimiseLevel < 0 || options.optimiseLevel > 3)
+	{
+		return "optimisation level must be between 0 and 3";
+	}
+	if (options.threads < 1)
+	{
+		return "number of threads must be at least 1";
+	}
+	if (options.tileSize < 0)
+	{
+		return "tile size must not be negative";
+	}
+	return std::string();
+}
+
+std::unique_ptr<Kernel> Kernel::create(const Program &program,
+                                       const Options &options,
+                                       std::string &error)
+{
+	error = checkOptions(options);
+	if (!error.empty())
+	{
+		return nullptr;
+	}
+	std::unique_ptr<Impl> impl(new Impl(program.ast, options));
+	AST::StatementList *ast = impl->ast.get();
+	Grid::Boundary boundary = options.boundary;
+	switch (options.engine)
+	{
+		case Engine::Interpreter:
+			impl->run = [=](int16_t *o, int16_t *n,
+			                Grid::Coordinate w, Grid::Coordinate h,
+			                Grid::Coordinate xStart, Grid::Coordinate xEnd,
+			                Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+				Interpreter::runOneStep(o, n, w, h, xStart, xEnd, yStart, yEnd,
+				                        ast, boundary);
+			};
+			break;
+		case Engine::Bytecode:
+		{
+			impl->bytecode = Bytecode::compile(ast, boundary);
+			if (!impl->bytecode.error.empty())
+			{
+				error = impl->bytecode.error;
+				return nullptr;
+			}
+			Bytecode::Program *bytecode = &impl->bytecode;
+			impl->run = [=](int16_t *o, int16_t *n,
+			                Grid::Coordinate w, Grid::Coordinate h,
+			                Grid::Coordinate xStart, Grid::Coordinate xEnd,
+			                Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+				Bytecode::runOneStep(o, n, w, h, xStart, xEnd, yStart, yEnd,
+				                     *bytecode);
+			};
+			break;
+		}
+		case Engine::Compiled:
+		{
+			Compiler::automaton ca =
+				Compiler::compile(ast, options.optimiseLevel,
+				                  options.vectorise, boundary,
+				                  options.runtimePath,
+				                  options.cacheDirectory, impl->code);
+			if (!ca)
+			{
+				error = Compiler::lastError();
+				return nullptr;
+			}
+			impl->run = ca;
+			break;
+		}
+	}
+	return std::unique_ptr<Kernel>(new Kernel(std::move(impl)));
+}
+
+Kernel::~Kernel() {}
+
+int16_t *Kernel::step(int16_t *grid,
+                      int16_t *spare,
+                      Grid::Coordinate width,
+                      Grid::Coordinate height,
+                      int generations)
+{
+	const Options &o = impl->options;
+	// The caller may change the grid between calls, so tiles that didn't
+	// change in the last call may change in the next, and every call starts
+	// with all tiles active.
+	std::unique_ptr<ActiveTiles> tiles;
+	if (o.tileSize > 0 && !impl->orderDependent)
+	{
+		tiles.reset(new ActiveTiles(width, height, o.tileSize, o.boundary));
+	}
+	Schedule schedule = { width, height, o.boundary, o.edgeValue, 0, 1,
+	                      tiles.get(), &impl->pool, nullptr };
+	runGenerations(grid, spare, generations, schedule, impl->run);
+	return grid;
+}
+
+struct cellatom_program
+{
+	std::unique_ptr<Program> program;
+};
+
+struct cellatom_kernel
+{
+	std::unique_ptr<Kernel> kernel;
+};
+
+/**
+ * Copies an error message into a caller's buffer, truncating it if necessary.
+ */
+static void copyError(const std::string &message, char *error, size_t size)
+{
+	if (error && size > 0)
+	{
+		strncpy(error, message.c_str(), size - 1);
+		error[size - 1] = 0;
+	}
+}
+
+/**
+ * Wraps a parsed program for the C interface, or reports the error.
+ */
+static cellatom_program *wrapProgram(std::unique_ptr<Program> program,
+                                     const std::string &message,
+                                     char *error,
+                                     size_t size)
+{
+	if (!program)
+	{
+		copyError(message, error, size);
+		return nullptr;
+	}
+	return new cellatom_program { std::move(program) };
+}
+
+extern "C"
+{
+
+void cellatom_options_init(struct cellatom_options *options)
+{
+	Options defaults;
+	options->engine = CELLATOM_COMPILED;
+	options->optimise_level = defaults.optimiseLevel;
+	options->vectorise = defaults.vectorise;
+	options->boundary = CELLATOM_TRUNCATE;
+	options->edge_value = defaults.edgeValue;
+	options->threads = defaults.threads;
+	options->tile_size = defaults.tileSize;
+	options->runtime_path = nullptr;
+	options->cache_directory = nullptr;
+}
+
+cellatom_program *cellatom_parse(const char *source,
+                                 char *error,
+                                 size_t error_size)
+{
+	std::string message;
+	std::unique_ptr<Program> program = Program::parse(source, message);
+	return wrapProgram(std::move(program), message, error, error_size);
+}
+
+cellatom_program *cellatom_load(const char *file_name,
+                                char *error,
+                                size_t error_size)
+{
+	std::string message;
+	std::unique_ptr<Program> program = Program::load(file_name, message);
+	return wrapProgram(std::move(program), message, error, error_size);
+}
+
+int cellatom_uses_globals(const cellatom_program *program)
+{
+	return program->program->usesGlobals();
+}
+
+void cellatom_program_free(cellatom_program *program)
+{
+	delete program;
+}
+
+cellatom_kernel *cellatom_kernel_create(const cellatom_program *program,
+                                        const struct cellatom_options *options,
+                                        char *error,
+                                        size_t error_size)
+{
+	Options o;
+	switch (options->engine)
+	{
+		default:
+			copyError("unknown engine", error, error_size);
+			return nullptr;
+		case CELLATOM_INTERPRETER:
+			o.engine = Engine::Interpreter;
+			break;
+		case CELLATOM_BYTECODE:
+			o.engine = Engine::Bytecode;
+			break;
+		case CELLATOM_COMPILED:
+			o.engine = Engine::Compiled;
+			break;
+	}
+	switch (options->boundary)
+	{
+		default:
+			copyError("unknown boundary mode", error, error_size);
+			return nullptr;
+		case CELLATOM_TRUNCATE:
+			o.boundary = Grid::Boundary::Truncate;
+			break;
+		case CELLATOM_WRAP:
+			o.boundary = Grid::Boundary::Wrap;
+			break;
+		case CELLATOM_CONSTANT:
+			o.boundary = Grid::Boundary::Constant;
+			break;
+	}
+	o.optimiseLevel = options->optimise_level;
+	o.vectorise = options->vectorise != 0;
+	o.edgeValue = options->edge_value;
+	o.threads = options->threads;
+	o.tileSize = options->tile_size;
+	if (options->runtime_path)
+	{
+		o.runtimePath = options->runtime_path;
+	}
+	if (options->cache_directory)
+	{
+		o.cacheDirectory = options->cache_directory;
+	}
+	std::string message;
+	std::unique_ptr<Kernel> kernel = Kernel::create(*program->program, o,
+	                                                message);
+	if (!kernel)
+	{
+		copyError(message, error, error_size);
+		return nullptr;
+	}
+	return new cellatom_kernel { std::move(kernel) };
+}
+
+void cellatom_kernel_free(cellatom_kernel *kernel)
+{
+	delete kernel;
+}
+
+int16_t *cellatom_step(cellatom_kernel *kernel,
+                       int16_t *grid,
+                       int16_t *spare,
+                       int64_t width,
+                       int64_t height,
+                       int generations)
+{
+	return kernel->kernel->step(grid, spare, width, height, generations);
+}
+
+size_t cellatom_grid_size(int64_t width, int64_t height)
+{
+	return Grid::size(width, height);
+}
+
+size_t cellatom_grid_index(int64_t height, int64_t x, int64_t y)
+{
+	return Grid::index(height, x, y);
+}
+
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_CELLATOM_H_INCLUDED
+#define CELLATOM_CELLATOM_H_INCLUDED
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The C interface for embedding CellAtom in other programs.  This is a thin
+ * wrapper around the C++ interface in cellatom.hh, which describes each
+ * function in more detail.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A parsed program */
+typedef struct cellatom_program cellatom_program;
+/** A program prepared to run with one engine and set of options */
+typedef struct cellatom_kernel cellatom_kernel;
+
+/** The engines that can run a program */
+enum cellatom_engine
+{
+	CELLATOM_INTERPRETER,
+	CELLATOM_BYTECODE,
+	CELLATOM_COMPILED
+};
+
+/** How the neighbours of the cells at the edges of the grid are found */
+enum cellatom_boundary
+{
+	CELLATOM_TRUNCATE,
+	CELLATOM_WRAP,
+	CELLATOM_CONSTANT
+};
+
+/** The settings for a kernel */
+struct cellatom_options
+{
+	enum cellatom_engine engine;
+	int optimise_level;
+	int vectorise;
+	enum cellatom_boundary boundary;
+	int16_t edge_value;
+	int threads;
+	int16_t tile_size;
+	/** The directory containing runtime.bc, or NULL for the current one */
+	const char *runtime_path;
+	/** The directory to keep compiled code in, or NULL for none */
+	const char *cache_directory;
+};
+
+/**
+ * Sets every option to its default, which is the same as for the C++
+ * interface.
+ */
+void cellatom_options_init(struct cellatom_options *options);
+/**
+ * Parses a program from a string or a file.  These return NULL if the
+ * program can't be parsed, and write a description of the problem to `error`
+ * (which may be NULL), truncated to `error_size` bytes.
+ */
+cellatom_program *cellatom_parse(const char *source,
+                                 char *error,
+                                 size_t error_size);
+cellatom_program *cellatom_load(const char *file_name,
+                                char *error,
+                                size_t error_size);
+/** Returns non-zero if the program uses global registers */
+int cellatom_uses_globals(const cellatom_program *program);
+/** Destroys a program.  Kernels created from it can still be used. */
+void cellatom_program_free(cellatom_program *program);
+/**
+ * Prepares a program to run with the specified options.  Returns NULL if the
+ * options are invalid or the program can't be compiled, and reports the
+ * problem in the same way as `cellatom_parse`.
+ */
+cellatom_kernel *cellatom_kernel_create(const cellatom_program *program,
+                                        const struct cellatom_options *options,
+                                        char *error,
+                                        size_t error_size);
+/** Destroys a kernel, freeing any code generated for it */
+void cellatom_kernel_free(cellatom_kernel *kernel);
+/**
+ * Runs `generations` generations on a grid, returning whichever of `grid` and
+ * `spare` holds the result.
+ */
+int16_t *cellatom_step(cellatom_kernel *kernel,
+                       int16_t *grid,
+                       int16_t *spare,
+                       int64_t width,
+                       int64_t height,
+                       int generations);
+/** The number of cells, including the halo, to allocate for a grid */
+size_t cellatom_grid_size(int64_t width, int64_t height);
+/** The index of the cell at (x, y) in a grid */
+size_t cellatom_grid_index(int64_t height, int64_t x, int64_t y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_CELLATOM_HH_INCLUDED
+#define CELLATOM_CELLATOM_HH_INCLUDED
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "grid.hh"
+
+namespace AST
+{
+	struct StatementList;
+}
+
+/**
+ * The interface for embedding CellAtom in other programs.  A program is
+ * parsed once into a `Program`, and then compiled into any number of
+ * `Kernel`s, which can all exist at the same time.  Each kernel runs
+ * generations of the program on grids that belong to the caller.
+ */
+namespace CellAtom
+{
+	/**
+	 * The engines that can run a program.
+	 */
+	enum class Engine
+	{
+		/** The AST interpreter */
+		Interpreter,
+		/** The bytecode VM */
+		Bytecode,
+		/** Machine code generated by the JIT compiler */
+		Compiled
+	};
+
+	/**
+	 * The settings for a kernel.  These are fixed when the kernel is created.
+	 */
+	struct Options
+	{
+		/** The engine that runs the program */
+		Engine engine = Engine::Compiled;
+		/** The optimisation level for the compiled engine, from 0 to 3 */
+		int optimiseLevel = 2;
+		/** Whether the compiled engine should explicitly vectorise the program */
+		bool vectorise = false;
+		/** How the neighbours of the cells at the edges are found */
+		Grid::Boundary boundary = Grid::Boundary::Truncate;
+		/** The value of neighbours beyond the edges for constant boundaries */
+		int16_t edgeValue = 0;
+		/** The number of threads to run each generation on, at least 1 */
+		int threads = 1;
+		/**
+		 * The size of the tiles to skip when they can't change, or 0 to
+		 * compute every cell.  Tiles are never skipped for programs whose
+		 * global registers depend on the order of the cells.
+		 */
+		int16_t tileSize = 32;
+		/**
+		 * The directory containing `runtime.bc`, which the compiled engine
+		 * needs, or an empty string for the current directory.
+		 */
+		std::string runtimePath;
+		/**
+		 * The directory to keep compiled code in and reuse it from, or an
+		 * empty string to always compile.
+		 */
+		std::string cacheDirectory;
+	};
+
+	/**
+	 * A parsed program.  Kernels keep their own reference to the program, so
+	 * it may be destroyed while they are still in use.
+	 */
+	class Program
+	{
+		friend class Kernel;
+		/** The AST of the program */
+		std::shared_ptr<AST::StatementList> ast;
+		Program(std::shared_ptr<AST::StatementList> a) : ast(a) {}
+		public:
+		/**
+		 * Parses the source of a program.  Returns null, and sets `error` to
+		 * a description of the problem, if it can't be parsed.
+		 */
+		static std::unique_ptr<Program> parse(const std::string &source,
+		                                      std::string &error);
+		/**
+		 * Parses a program from a file.  Returns null, and sets `error` to a
+		 * description of the problem, if it can't be read or parsed.
+		 */
+		static std::unique_ptr<Program> load(const std::string &fileName,
+		                                     std::string &error);
+		/**
+		 * Returns true if the program uses global registers.  Each thread
+		 * has its own set of global registers, so programs whose registers
+		 * depend on the order of the cells are always run on one thread.
+		 */
+		bool usesGlobals() const;
+	};
+
+	/**
+	 * A program prepared to run with one engine and set of options.  For the
+	 * compiled engine, the kernel owns the generated code and frees it when
+	 * it is destroyed.  A kernel may only run one grid at a time, but
+	 * different kernels may run at the same time on different threads.
+	 */
+	class Kernel
+	{
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+		Kernel(std::unique_ptr<Impl> i);
+		public:
+		/**
+		 * Prepares a program to run with the specified options.  Returns
+		 * null, and sets `error` to a description of the problem, if the
+		 * options are invalid or the program can't be compiled.
+		 */
+		static std::unique_ptr<Kernel> create(const Program &program,
+		                                      const Options &options,
+		                                      std::string &error);
+		~Kernel();
+		/**
+		 * Runs `generations` generations of the program on a grid of `width`
+		 * by `height` cells, which must both be at least 1.  Both
+		 * `grid`, which holds the first generation, and `spare` must have
+		 * room for `Grid::size(width, height)` cells, and are laid out as
+		 * described in `grid.hh`.  The halos are filled in by the kernel.
+		 * The generations alternate between the two buffers, so the result
+		 * may be in either, and a pointer to the one that holds it is
+		 * returned.
+		 */
+		int16_t *step(int16_t *grid,
+		              int16_t *spare,
+		              Grid::Coordinate width,
+		              Grid::Coordinate height,
+		              int generations);
+	};
+}
+
+#endif
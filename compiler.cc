@@ -21,8 +21,10 @@
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/DerivedTypes.h>
@@ -30,9 +32,15 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Linker/Linker.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MD5.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
@@ -41,21 +49,157 @@
 #include <llvm/Transforms/IPO/AlwaysInliner.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <numeric>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "ast.hh"
 
 using namespace llvm;
 
+extern char **environ;
+
 namespace Compiler
 {
+/**
+ * The times for the most recent compilation on each thread.
+ */
+static thread_local CompileTimes times;
+
+CompileTimes lastCompileTimes()
+{
+	return times;
+}
+
+/**
+ * The reason that the most recent compilation on each thread failed.
+ */
+static thread_local std::string errorMessage;
+
+const std::string &lastError()
+{
+	return errorMessage;
+}
+
+/**
+ * Returns the number of seconds since `start`.
+ */
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+/**
+ * A cache of compiled automata, stored as object files in a directory.  The
+ * object for a module is named by its identifier, which the compiler sets to
+ * a hash of everything that affects the generated code, so entries never need
+ * to be invalidated.  Failing to read or write the cache just means that the
+ * code is generated again.
+ */
+class DiskCache : public ObjectCache
+{
+	/** The directory that holds the objects */
+	std::string directory;
+	/** The object found by `load`, until the execution engine asks for it */
+	std::unique_ptr<MemoryBuffer> object;
+	/** Returns the file name for the object for a module */
+	std::string fileName(const Module *M)
+	{
+		return directory + "/" + M->getModuleIdentifier() + ".o";
+	}
+	public:
+	DiskCache(const std::string &dir) : directory(dir)
+	{
+		sys::fs::create_directories(directory);
+	}
+	/**
+	 * Loads the object for the module, if the cache has one, and returns
+	 * true if it does.  This decides whether the module is a hit or a miss:
+	 * the execution engine is given this object, rather than one that is
+	 * read later, so a file that is replaced or removed in between can't
+	 * leave it generating code for the unoptimised module.
+	 */
+	bool load(const Module *M)
+	{
+		// Large files are mapped rather than read.
+		auto buffer = MemoryBuffer::getFile(fileName(M));
+		if (!buffer)
+		{
+			return false;
+		}
+		object = std::move(buffer.get());
+		return true;
+	}
+	void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override
+	{
+		// Many jobs, and many threads in one job, may share the cache, so
+		// write to a uniquely named file and then rename it, so that the
+		// others never see a partial object.
+		std::string name = fileName(M);
+		SmallString<128> tmp;
+		int fd;
+		if (sys::fs::createUniqueFile(name + ".%%%%%%", fd, tmp))
+		{
+			return;
+		}
+		raw_fd_ostream out(fd, true);
+		out << Obj.getBuffer();
+		out.close();
+		if (out.has_error())
+		{
+			out.clear_error();
+			sys::fs::remove(tmp);
+			return;
+		}
+		sys::fs::rename(tmp, name);
+	}
+	std::unique_ptr<MemoryBuffer> getObject(const Module *M) override
+	{
+		return std::move(object);
+	}
+};
+
+/**
+ * The code for a compiled automaton.  The execution engine owns the module and
+ * the target machine, but not the context that the module was created in or
+ * the cache that it loads objects from, so this owns those as well and
+ * destroys them after the engine.
+ */
+struct JITCode : public Code
+{
+	/** The context that the module was created in */
+	std::unique_ptr<LLVMContext> Context;
+	/** The cache that the engine uses, if any */
+	std::unique_ptr<DiskCache> Cache;
+	/** The JIT, which owns the memory for the generated code */
+	std::unique_ptr<ExecutionEngine> EE;
+};
+
 struct State
 {
-	/** LLVM uses a context object to allow multiple threads */
-	LLVMContext C;
+	/**
+	 * LLVM uses a context object to allow multiple threads.  The module is
+	 * created in this one, so it is handed over to the compiled code.
+	 */
+	std::unique_ptr<LLVMContext> Context;
+	/** The context, while it is owned by this object */
+	LLVMContext &C;
 	/** The compilation unit that we are generating */
 	std::unique_ptr<Module> Mod;
-	/** The function representing the program */
+	/** The target machine that we are generating code for */
+	std::unique_ptr<TargetMachine> TM;
+	/** The name of the host CPU */
+	std::string cpu;
+	/** The features of the host CPU, in the form that LLVM takes them */
+	std::string features;
+	/** The function currently being generated */
 	Function *F;
 	/** A helper class for generating instructions */
 	IRBuilder<> B;
@@ -63,6 +207,11 @@ struct State
 	Value *a[10];
 	/** The 10 global registers in the source language */
 	Value *g[10];
+	/**
+	 * How the kernel uses each global register.  Writes to unused registers
+	 * are dead and aren't generated.
+	 */
+	Analysis::GlobalUse globalUses[10];
 	/** The input grid (passed as an argument) */
 	Value *oldGrid;
 	/** The output grid (passed as an argument) */
@@ -73,22 +222,92 @@ struct State
 	Value *height;
 	/** The x coordinate of the current cell (passed as an argument) */
 	Value *x;
-	/** The y coordinate of the current cell (passed as an argument) */
+	/**
+	 * The y coordinate of the current cell (passed as an argument).  When
+	 * generating the vector kernel, this is the y coordinate of the first
+	 * lane.
+	 */
 	Value *y;
 	/**
 	 * The value of the current cell (passed as an argument, returned at the end)
 	 */
 	Value *v;
-	/** The type of our registers (currently i16) */
+	/**
+	 * The index of the first cell in the grid.  Only used by the vector and
+	 * ensemble kernels, which load and store the cells themselves.
+	 */
+	Value *index;
+	/**
+	 * The number of grids in the ensemble (passed as an argument), or null if
+	 * not generating one of the ensemble kernels.
+	 */
+	Value *count;
+	/**
+	 * The first member of the ensemble that the kernel computes the cell in
+	 * (passed as an argument).  Only used by the ensemble kernels.
+	 */
+	Value *member;
+	/**
+	 * Whether the function being generated is only used for cells that have
+	 * all eight neighbours, and so doesn't need any bounds checks.
+	 */
+	bool interior;
+	/**
+	 * The number of cells being computed at once.  Zero when generating the
+	 * scalar kernel.
+	 */
+	unsigned lanes;
+	/**
+	 * The type of a cell in the grid: i16, or i8 if every value that the
+	 * kernel computes is known to fit.
+	 */
+	IntegerType *cellTy;
+	/**
+	 * The suffix on the names of the runtime functions and constants for the
+	 * type of cell in use.
+	 */
+	std::string suffix;
+	/**
+	 * The type of our registers (the cell type, or a vector of it when
+	 * generating the vector kernel)
+	 */
 	Type *regTy;
+	/**
+	 * The profile that range expressions are laid out for, and that the
+	 * code adds to if it is being collected, or null.
+	 */
+	Profile *profile;
+	/**
+	 * The number of counts for each range expression, in the order that they
+	 * were first compiled, which is the order that they appear in the
+	 * program.
+	 */
+	std::vector<unsigned> profileLayout;
+	/** The position in `profileLayout` of each range expression */
+	std::map<const AST::RangeExpr*, size_t> profileIndex;
+	/**
+	 * A placeholder for the address of the counts, while they are being
+	 * collected.  This is replaced when the layout is complete.
+	 */
+	GlobalVariable *profileCounts;
+
+	/**
+	 * The reason that the state could not be set up, or empty if it was.
+	 */
+	std::string error;
 
 	/**
 	 * Construct the compiler state object.  This loads the runtime.bc support
 	 * file and prepares the module, including setting up all of the LLVM state
-	 * required.
+	 * required.  If `standalone` is true, then the code will be written to a
+	 * file and linked into another program, rather than run in this process.
+	 * If anything fails, then `error` is set and nothing else may be used.
 	 */
-	State(const std::string &path) : B(C)
+	State(const std::string &path, bool standalone=false)
+		: Context(new LLVMContext), C(*Context), B(C), count(nullptr),
+		  profile(nullptr), profileCounts(nullptr)
 	{
+		std::fill(globalUses, globalUses+10, Analysis::GlobalUse::Ordered);
 		std::string bcpath;
 		if (path.size() == 0)
 		{
@@ -102,22 +321,171 @@ struct State
 		auto buffer = MemoryBuffer::getFile(bcpath);
 		if (std::error_code ec = buffer.getError())
 		{
-			std::cerr << "Failed to open " << bcpath << ": " << ec.message() << std::endl;
-			exit(EXIT_FAILURE);
+			error = "Failed to open " + bcpath + ": " + ec.message();
+			return;
 		}
 		auto e = parseBitcodeFile(buffer.get()->getMemBufferRef(), C);
 		if (auto ec = e.takeError())
 		{
-			std::cerr << "Failed to parse runtime.bc: " << std::endl;
-			exit(EXIT_FAILURE);
+			error = "Failed to parse " + bcpath + ": " + toString(std::move(ec));
+			return;
 		}
 		Mod.swap(e.get());
 
-		Function *Automaton = Mod->getFunction("automaton");
-		Automaton->removeFnAttr(Attribute::OptimizeNone);
-		
+		// The runtime is compiled at -O0 so that clang doesn't inline the
+		// (empty) kernel prototypes away, so undo the attributes that this
+		// adds.
+		for (auto &I : *Mod)
+		{
+			I.removeFnAttr(Attribute::OptimizeNone);
+			I.removeFnAttr(Attribute::NoInline);
+		}
+
+		// Create a target machine for the host from the module triple. This
+		// is needed to add associated target passes, so that (among others)
+		// automatic vectorization works, and to pick a vector width for the
+		// explicitly vectorised kernel.
+		std::string const TripleDesc = Mod->getTargetTriple();
+		Target const *Tgt = TargetRegistry::lookupTarget(TripleDesc, error);
+		if (!Tgt)
+		{
+			error = "No target for " + TripleDesc + ": " + error;
+			return;
+		}
+		SubtargetFeatures Features;
+		StringMap<bool> HostFeatures;
+		if (sys::getHostCPUFeatures(HostFeatures))
+		{
+			for (auto &Feature : HostFeatures)
+			{
+				Features.AddFeature(Feature.first(), Feature.second);
+			}
+		}
+		cpu = sys::getHostCPUName();
+		features = Features.getString();
+		// Code that is linked into other programs may end up in a shared
+		// library, so must be position independent.
+		Optional<Reloc::Model> relocation;
+		CodeModel::Model codeModel = CodeModel::JITDefault;
+		if (standalone)
+		{
+			relocation = Reloc::PIC_;
+			codeModel = CodeModel::Default;
+		}
+		TM.reset(Tgt->createTargetMachine(TripleDesc,
+				cpu,
+				features,
+				TargetOptions(),
+				relocation,
+				codeModel));
+		if (!TM)
+		{
+			error = "Unable to create a target machine for " + TripleDesc;
+		}
+	}
+
+	/**
+	 * Removes the automaton for one type of cell, and the kernels that it
+	 * calls, from the runtime.
+	 */
+	void removeAutomaton(const std::string &unused)
+	{
+		// The automaton calls the kernels, so must be removed first.
+		for (const char *name : { "automaton", "cell", "cell_interior",
+		                          "cell_vector" })
+		{
+			Mod->getFunction(name + unused)->eraseFromParent();
+		}
+		Mod->getNamedGlobal("cell_lanes" + unused)->eraseFromParent();
+	}
+
+	/**
+	 * Selects the type of cells in the grid.  The runtime contains a copy of
+	 * the automaton for 16-bit cells and one for 8-bit cells, and one for
+	 * ensembles, and only the selected one has its kernels generated, so the
+	 * others are removed.
+	 */
+	void setCellType(bool narrow)
+	{
+		cellTy = narrow ? Type::getInt8Ty(C) : Type::getInt16Ty(C);
+		suffix = narrow ? "_i8" : "";
+		count = nullptr;
+		removeAutomaton(narrow ? "" : "_i8");
+		for (const char *name : { "ensemble", "ensemble_vector",
+		                          "ensemble_cell" })
+		{
+			Mod->getFunction(name)->eraseFromParent();
+		}
+		Mod->getNamedGlobal("ensemble_lanes")->eraseFromParent();
+	}
+
+	/**
+	 * Selects the ensemble automaton, which always uses 16-bit cells, and
+	 * removes the others.
+	 */
+	void setEnsemble()
+	{
+		cellTy = Type::getInt16Ty(C);
+		suffix = "";
+		removeAutomaton("");
+		removeAutomaton("_i8");
+		Mod->getNamedGlobal("cell_truncate")->eraseFromParent();
+	}
+
+	/**
+	 * Returns the size of a cell, in bytes.
+	 */
+	unsigned cellSize()
+	{
+		return cellTy->getBitWidth() / 8;
+	}
+
+	/**
+	 * Creates the stack space for the registers and the pointers to the
+	 * global registers.  The `v` register is created, but not initialised.
+	 */
+	void createRegisters(Value *gArg)
+	{
+		// Create space on the stack for the local registers
+		for (int i=0 ; i<10 ; i++)
+		{
+			a[i] = B.CreateAlloca(regTy);
+		}
+		// Create a space on the stack for the current value.  This can be
+		// assigned to, and will be returned at the end.
+		v = B.CreateAlloca(regTy);
+
+		// Create a load of pointers to the global registers.  Ensembles
+		// interleave the global registers of each member, so the registers of
+		// the members in each lane are adjacent and can be loaded as a vector.
+		for (int i=0 ; i<10 ; i++)
+		{
+			B.CreateStore(ConstantInt::get(regTy, 0), a[i]);
+			if (count)
+			{
+				Value *idx = B.CreateAdd(B.CreateMul(count,
+					ConstantInt::get(count->getType(), i)), member);
+				g[i] = B.CreateBitCast(B.CreateGEP(gArg, idx),
+				                       regTy->getPointerTo());
+			}
+			else
+			{
+				g[i] = B.CreateConstGEP1_32(gArg, i);
+			}
+		}
+	}
+
+	/**
+	 * Prepares to generate one of the scalar cell functions, which compute
+	 * the value of a single cell.  The `cell` function can be used anywhere
+	 * in the grid, the `cell_interior` function only for cells that have all
+	 * eight neighbours.
+	 */
+	void beginCell(const char *name, bool isInterior)
+	{
+		interior = isInterior;
 		// Get the stub (prototype) for the cell function
-		F = Mod->getFunction("cell");
+		F = Mod->getFunction(name + suffix);
 		// Set it to have private linkage, so that it can be removed after being
 		// inlined.
 		F->setLinkage(GlobalValue::PrivateLinkage);
@@ -126,7 +494,8 @@ struct State
 		BasicBlock *entry = BasicBlock::Create(C, "entry", F);
 		B.SetInsertPoint(entry);
 		// Cache the type of registers
-		regTy = Type::getInt16Ty(C);
+		regTy = cellTy;
+		lanes = 0;
 
 		// Collect the function parameters
 		auto args = F->arg_begin();
@@ -136,36 +505,379 @@ struct State
 		height = &*(args++);
 		x = &*(args++);
 		y = &*(args++);
+		Value *vArg = &*(args++);
+		createRegisters(&*args);
+		// Store the value passed as a parameter in the v register.
+		B.CreateStore(vArg, v);
+	}
 
-		// Create space on the stack for the local registers
-		for (int i=0 ; i<10 ; i++)
+	/**
+	 * Finishes a scalar cell function.
+	 */
+	void endCell()
+	{
+		// We've finished generating code, so add a return statement - we're
+		// returning the value of the v register.
+		B.CreateRet(B.CreateLoad(v));
+	}
+
+	/**
+	 * Returns the number of cells that fit in a vector register on the
+	 * target, or zero if the target has no vector registers.
+	 */
+	unsigned vectorWidth()
+	{
+		// The answer is the same for every function in the module, so ask
+		// about the last one generated.
+		FunctionAnalysisManager FAM;
+		TargetTransformInfo TTI = TM->getTargetIRAnalysis().run(*F, FAM);
+		unsigned width = TTI.getRegisterBitWidth(true) / cellTy->getBitWidth();
+		return width > 1 ? width : 0;
+	}
+
+	/**
+	 * Prepares to generate the `cell_vector` function, which computes
+	 * `vectorLanes` adjacent cells in a single row, one per vector lane.  If
+	 * `vectorLanes` is zero then the runtime will never call this function,
+	 * so it is left empty.
+	 */
+	void beginVectorCell(unsigned vectorLanes)
+	{
+		lanes = vectorLanes;
+		interior = true;
+		// Tell the runtime how many cells each call computes.
+		defineConstant("cell_lanes" + suffix, lanes);
+
+		F = Mod->getFunction("cell_vector" + suffix);
+		F->setLinkage(GlobalValue::PrivateLinkage);
+		F->addFnAttr(Attribute::AlwaysInline);
+		BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+		B.SetInsertPoint(entry);
+		if (lanes == 0)
 		{
-			a[i] = B.CreateAlloca(regTy);
+			return;
 		}
-		// Create a space on the stack for the current value.  This can be
-		// assigned to, and will be returned at the end.  Store the value passed
-		// as a parameter in this.
-		v = B.CreateAlloca(regTy);
-		B.CreateStore(&*(args++), v);
+		regTy = VectorType::get(cellTy, lanes);
 
-		// Create a load of pointers to the global registers.
-		Value *gArg = &*args;
-		for (int i=0 ; i<10 ; i++)
+		auto args = F->arg_begin();
+		oldGrid = &*(args++);
+		newGrid = &*(args++);
+		width = &*(args++);
+		height = &*(args++);
+		x = &*(args++);
+		y = &*(args++);
+		createRegisters(&*args);
+
+		// Load the current values of all of the cells in this vector into
+		// the v register.
+		index = gridIndex(0, 0);
+		B.CreateStore(loadVector(oldGrid, index), v);
+	}
+
+	/**
+	 * Finishes the `cell_vector` function.
+	 */
+	void endVectorCell()
+	{
+		// Unlike the scalar version, the vector kernel writes its results to
+		// the grid directly.
+		if (lanes > 0)
 		{
-			B.CreateStore(ConstantInt::get(regTy, 0), a[i]);
-			g[i] = B.CreateConstGEP1_32(gArg, i);
+			Value *addr = B.CreateBitCast(B.CreateGEP(newGrid, index),
+			                              regTy->getPointerTo());
+			B.CreateAlignedStore(B.CreateLoad(v), addr, cellSize());
 		}
+		B.CreateRetVoid();
 	}
 
 	/**
-	 * Returns a function pointer for the automaton at the specified
-	 * optimisation level.
+	 * Prepares to generate one of the ensemble kernels, which compute the
+	 * same cell in `vectorLanes` consecutive members of the ensemble, one per
+	 * vector lane, or in a single member if `vectorLanes` is zero.  The
+	 * members' copies of a cell are adjacent and they all have the same
+	 * neighbours, so every lane runs the same instructions.  Bounds checks
+	 * depend only on the coordinates of the cell, so they are the same for
+	 * every lane.
 	 */
-	automaton getAutomaton(int optimiseLevel)
+	void beginEnsembleCell(const char *name,
+	                       unsigned vectorLanes,
+	                       bool isInterior)
+	{
+		lanes = vectorLanes;
+		interior = isInterior;
+		F = Mod->getFunction(name);
+		F->setLinkage(GlobalValue::PrivateLinkage);
+		F->addFnAttr(Attribute::AlwaysInline);
+		BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+		B.SetInsertPoint(entry);
+		regTy = (lanes > 0) ? VectorType::get(cellTy, lanes) : cellTy;
+
+		auto args = F->arg_begin();
+		oldGrid = &*(args++);
+		newGrid = &*(args++);
+		width = &*(args++);
+		height = &*(args++);
+		count = &*(args++);
+		x = &*(args++);
+		y = &*(args++);
+		member = &*(args++);
+		createRegisters(&*args);
+
+		index = gridIndex(0, 0);
+		B.CreateStore(loadVector(oldGrid, index), v);
+	}
+
+	/**
+	 * Finishes one of the ensemble kernels, which write their results to the
+	 * grid directly.
+	 */
+	void endEnsembleCell()
+	{
+		Value *addr = B.CreateBitCast(B.CreateGEP(newGrid, index),
+		                              regTy->getPointerTo());
+		B.CreateAlignedStore(B.CreateLoad(v), addr, cellSize());
+		B.CreateRetVoid();
+	}
+
+	/**
+	 * Returns the number of a range expression with `arms` counts in the
+	 * profile, numbering it if this is the first time that it has been
+	 * compiled.
+	 */
+	size_t profileSlot(const AST::RangeExpr *e, unsigned arms)
+	{
+		auto found = profileIndex.find(e);
+		if (found != profileIndex.end())
+		{
+			return found->second;
+		}
+		size_t slot = profileLayout.size();
+		profileLayout.push_back(arms);
+		profileIndex[e] = slot;
+		return slot;
+	}
+
+	/**
+	 * Returns the counts in the profile for range expression `slot`, or null
+	 * if there is no profile or it was collected for a different program.
+	 */
+	const uint64_t *profileCountsFor(size_t slot)
+	{
+		if (!profile || (profile->arms.size() <= slot))
+		{
+			return nullptr;
+		}
+		size_t offset = 0;
+		for (size_t i=0 ; i<slot ; i++)
+		{
+			if (profile->arms[i] != profileLayout[i])
+			{
+				return nullptr;
+			}
+			offset += profileLayout[i];
+		}
+		if (profile->arms[slot] != profileLayout[slot])
+		{
+			return nullptr;
+		}
+		return &profile->counts[offset];
+	}
+
+	/**
+	 * Adds one to count `arm` of range expression `slot`, if the profile is
+	 * being collected.
+	 */
+	void countProfile(size_t slot, unsigned arm)
+	{
+		if (!profile || !profile->instrument)
+		{
+			return;
+		}
+		Type *i64 = Type::getInt64Ty(C);
+		if (!profileCounts)
+		{
+			profileCounts = new GlobalVariable(*Mod, i64, false,
+			                                   GlobalValue::ExternalLinkage,
+			                                   nullptr, "cellatom_profile");
+		}
+		size_t offset = arm;
+		for (size_t i=0 ; i<slot ; i++)
+		{
+			offset += profileLayout[i];
+		}
+		// Several threads may run the kernel at once.
+		Value *addr = B.CreateConstGEP1_64(profileCounts, offset);
+		B.CreateAtomicRMW(AtomicRMWInst::Add, addr, ConstantInt::get(i64, 1),
+		                  AtomicOrdering::Monotonic);
+	}
+
+	/**
+	 * Finishes collecting a profile, once every kernel has been generated.
+	 * The counts are reset if they were for a different program, and then
+	 * the code is pointed at them.
+	 */
+	void finishProfile()
+	{
+		if (!profile || !profile->instrument)
+		{
+			return;
+		}
+		if (profile->arms != profileLayout)
+		{
+			profile->arms = profileLayout;
+			profile->counts.assign(std::accumulate(profileLayout.begin(),
+			                                       profileLayout.end(), size_t(0)), 0);
+		}
+		if (!profileCounts)
+		{
+			return;
+		}
+		Type *i64 = Type::getInt64Ty(C);
+		Constant *addr = ConstantInt::get(i64,
+			reinterpret_cast<uintptr_t>(profile->counts.data()));
+		profileCounts->replaceAllUsesWith(
+			ConstantExpr::getIntToPtr(addr, i64->getPointerTo()));
+		profileCounts->eraseFromParent();
+		profileCounts = nullptr;
+	}
+
+	/**
+	 * Returns the entry for `reg` in a constant table of values for the
+	 * register values starting at `base`, or zero if `reg` is outside the
+	 * table.  The vector kernels load each lane's entry with a gather.
+	 */
+	Value *lookup(Value *reg, int base, const std::vector<uint16_t> &values)
+	{
+		std::vector<Constant*> entries;
+		for (uint16_t v : values)
+		{
+			entries.push_back(ConstantInt::get(cellTy, v));
+		}
+		ArrayType *tableTy = ArrayType::get(cellTy, values.size());
+		GlobalVariable *table = new GlobalVariable(*Mod, tableTy, true,
+			GlobalValue::PrivateLinkage, ConstantArray::get(tableTy, entries),
+			"range_table");
+		Type *i32 = Type::getInt32Ty(C);
+		Type *indexTy = (lanes > 0) ? VectorType::get(i32, lanes) : i32;
+		// Values below the base wrap around to large unsigned indexes, so a
+		// single comparison finds the values outside the table.
+		Value *index = B.CreateSub(B.CreateSExt(reg, indexTy),
+		                           ConstantInt::get(indexTy, base, true));
+		Value *inTable = B.CreateICmpULT(index,
+		                                 ConstantInt::get(indexTy, values.size()));
+		index = B.CreateSelect(inTable, index, Constant::getNullValue(indexTy));
+		Value *addr = B.CreateInBoundsGEP(table,
+			{ ConstantInt::get(i32, 0), index });
+		Value *zero = Constant::getNullValue(regTy);
+		if (lanes == 0)
+		{
+			return B.CreateSelect(inTable,
+			                      B.CreateAlignedLoad(addr, cellSize()), zero);
+		}
+		return B.CreateMaskedGather(addr, cellSize(), inTable, zero);
+	}
+
+	/**
+	 * Gives a value to one of the constants declared in the runtime.  The
+	 * runtime's loops will then be specialised for it.
+	 */
+	void defineConstant(const std::string &name, int16_t value)
+	{
+		GlobalVariable *Const = Mod->getNamedGlobal(name);
+		Const->setInitializer(ConstantInt::get(Type::getInt16Ty(C), value));
+		Const->setConstant(true);
+		Const->setLinkage(GlobalValue::PrivateLinkage);
+	}
+
+	/**
+	 * Returns the index in the grid of the cell at an offset of (dx, dy) from
+	 * the current cell.  The grid has a halo around it, so each row is two
+	 * cells longer than the height.  The coordinates are 64 bits, the width
+	 * of an address, so the arithmetic can't overflow for large grids and
+	 * the index needs no extension before it is used.  In the ensemble
+	 * kernels, this is the index of the cell in the first member that is
+	 * being computed.
+	 */
+	Value *gridIndex(int dx, int dy)
+	{
+		Type *indexTy = x->getType();
+		Value *row = B.CreateAdd(x, ConstantInt::get(indexTy, dx + 1, true));
+		Value *col = B.CreateAdd(y, ConstantInt::get(indexTy, dy + 1, true));
+		Value *stride = B.CreateAdd(height, ConstantInt::get(indexTy, 2));
+		Value *idx = B.CreateAdd(col, B.CreateMul(row, stride));
+		if (count)
+		{
+			idx = B.CreateAdd(B.CreateMul(idx, B.CreateSExt(count, indexTy)),
+			                  B.CreateSExt(member, indexTy));
+		}
+		return idx;
+	}
+
+	/**
+	 * Loads a vector of adjacent cells from a grid, starting at the specified
+	 * index.  When generating a scalar kernel, this loads a single cell.
+	 */
+	Value *loadVector(Value *grid, Value *idx)
+	{
+		Value *addr = B.CreateBitCast(B.CreateGEP(grid, idx),
+		                              regTy->getPointerTo());
+		return B.CreateAlignedLoad(addr, cellSize());
+	}
+
+	/**
+	 * Names the module with a hash of its (unoptimised) IR, the optimisation
+	 * level and the target.  The IR includes the runtime and every setting
+	 * that the kernels were compiled with, so two modules with the same name
+	 * will always produce the same code.
+	 */
+	void nameModule(int optimiseLevel)
+	{
+		std::string ir;
+		raw_string_ostream os(ir);
+		Mod->print(os, nullptr);
+		os << optimiseLevel << '\n' << Mod->getTargetTriple() << '\n'
+		   << cpu << '\n' << features << '\n';
+		os.flush();
+		MD5 hash;
+		hash.update(ir);
+		MD5::MD5Result result;
+		hash.final(result);
+		SmallString<32> name;
+		MD5::stringifyResult(result, name);
+		Mod->setModuleIdentifier(name);
+	}
+
+	/**
+	 * Returns the address of the automaton called `name` (plus the suffix for
+	 * the cell type) at the specified optimisation level, and sets `code` to
+	 * the object that owns it.  If `cache` is not null, then the compiled
+	 * code is taken from it, if it is there, and added to it otherwise.
+	 * Returns 0, after setting `error`, if the code can't be generated.
+	 */
+	uint64_t getAutomaton(const std::string &name,
+	                      int optimiseLevel,
+	                      std::unique_ptr<DiskCache> cache,
+	                      std::unique_ptr<Code> &code)
+	{
+		// If the object is in the cache, then the execution engine will use
+		// it instead of generating code, so the IR doesn't need optimising.
+		auto start = std::chrono::steady_clock::now();
+		if (!cache || !cache->load(Mod.get()))
+		{
+			optimise(optimiseLevel);
+		}
+		times.optimisation = secondsSince(start);
+		start = std::chrono::steady_clock::now();
+		uint64_t address = getFunctionAddress(name, std::move(cache), code);
+		times.codeGeneration = secondsSince(start);
+		return address;
+	}
+
+	/**
+	 * Runs the optimisation passes for the specified level over the module.
+	 */
+	void optimise(int optimiseLevel)
 	{
-		// We've finished generating code, so add a return statement - we're
-		// returning the value of the v register.
-		B.CreateRet(B.CreateLoad(v));
 #ifdef DEBUG_CODEGEN
 		// If we're debugging, then print the module in human-readable form to
 		// the standard error and verify it.
@@ -175,26 +887,6 @@ struct State
 
 		// Now we need to construct the set of optimisations that we're going to
 		// run.
-
-		// Create a target machine from the module triple. This is needed to add
-		// associated target passes, so that (among others) automatic vectorization
-		// works!
-		std::string const TripleDesc = Mod->getTargetTriple();
-		std::string error;
-		Target const *Tgt = TargetRegistry::lookupTarget(TripleDesc, error);
-		if (!Tgt) {
-			report_fatal_error("Module does not provide a target description.");
-		}
-		TargetMachine *TM = Tgt->createTargetMachine(TripleDesc,
-				"", // cpu
-				"", // features
-				TargetOptions(),
-				Optional<Reloc::Model>(),
-				CodeModel::JITDefault);
-		if (!TM) {
-			report_fatal_error("unable to create TargetMachine");
-		}
-
 		PassManagerBuilder PMBuilder;
 		// Set the optimisation level.  This defines what optimisation passes
 		// will be added.
@@ -228,35 +920,372 @@ struct State
 		PMBuilder.populateModulePassManager(*PerModulePasses);
 		PerModulePasses->run(*Mod);
 		delete PerModulePasses;
+	}
+
+	/**
+	 * Writes the module to a file, as LLVM bitcode if the name ends in `.bc`
+	 * and as a native object file otherwise.  Returns false, after reporting
+	 * the error, if the file can't be written.
+	 */
+	bool emit(const std::string &file)
+	{
+		std::error_code ec;
+		raw_fd_ostream out(file, ec, sys::fs::F_None);
+		if (ec)
+		{
+			std::cerr << "Failed to open " << file << ": " << ec.message() << std::endl;
+			return false;
+		}
+		if (StringRef(file).endswith(".bc"))
+		{
+			WriteBitcodeToFile(Mod.get(), out);
+			return true;
+		}
+		legacy::PassManager CodeGenPasses;
+		if (TM->addPassesToEmitFile(CodeGenPasses, out,
+		                            TargetMachine::CGFT_ObjectFile))
+		{
+			std::cerr << "The target can't write object files" << std::endl;
+			return false;
+		}
+		CodeGenPasses.run(*Mod);
+		return true;
+	}
 
-		// Now we are ready to generate some code.  First create the execution
-		// engine (JIT)
+	/**
+	 * Creates the execution engine (JIT) for the module and returns the
+	 * address of the automaton called `name`.  The engine, the context and the
+	 * cache are moved into `code`.  Returns 0, after setting `error`, if the
+	 * engine can't be created or the automaton can't be compiled.
+	 */
+	uint64_t getFunctionAddress(const std::string &name,
+	                            std::unique_ptr<DiskCache> cache,
+	                            std::unique_ptr<Code> &code)
+	{
+		std::unique_ptr<JITCode> jit(new JITCode);
 		EngineBuilder EB(std::move(Mod));
 		EB.setErrorStr(&error);
-		ExecutionEngine *EE = EB.create(TM);
-		if (!EE)
+		jit->EE.reset(EB.create(TM.release()));
+		if (!jit->EE)
 		{
-			fprintf(stderr, "Error: %s\n", error.c_str());
-			exit(-1);
+			error = "Failed to create the JIT: " + error;
+			return 0;
+		}
+		if (cache)
+		{
+			jit->EE->setObjectCache(cache.get());
 		}
 		// Now tell it to compile
-		return reinterpret_cast<automaton>(EE->getFunctionAddress("automaton"));
+		uint64_t address = jit->EE->getFunctionAddress(name + suffix);
+		if (address == 0)
+		{
+			error = "Failed to compile " + name + suffix;
+			return 0;
+		}
+		jit->Cache = std::move(cache);
+		jit->Context = std::move(Context);
+		code = std::move(jit);
+		return address;
 	}
 
 };
 
-automaton compile(AST::StatementList *ast, int optimiseLevel, const std::string &path)
+/**
+ * Prepares LLVM to generate code for the host.
+ */
+static void initialiseTarget()
 {
 	// These functions do nothing, they just ensure that the correct modules are
 	// not removed by the linker.
 	InitializeNativeTarget();
 	InitializeNativeTargetAsmPrinter();
 	LLVMLinkInMCJIT();
-	
+}
+
+/**
+ * Generates the kernels for the AST, for cells of either 16 or 8 bits.
+ */
+static void generateKernels(State &s,
+                            AST::StatementList *ast,
+                            bool vectorise,
+                            Grid::Boundary boundary,
+                            bool narrow)
+{
+	s.setCellType(narrow);
+	// The scalar kernels are always needed.  The general one is used for the
+	// cells at the edges of the grid, and the one without any bounds checks
+	// for the rest.  Unless the neighbourhood is truncated, the halo gives
+	// the cells at the edges eight neighbours too, so the runtime only uses
+	// the second and neither needs bounds checks.
+	Analysis::classifyGlobals(ast, s.globalUses);
+	bool truncate = (boundary == Grid::Boundary::Truncate);
+	s.defineConstant("cell_truncate", truncate);
+	s.beginCell("cell", !truncate);
+	ast->compile(s);
+	s.endCell();
+	s.beginCell("cell_interior", true);
+	ast->compile(s);
+	s.endCell();
+	// The vector kernel computes adjacent cells at the same time, so the
+	// order of accesses to global registers would not be preserved.  That
+	// only matters if a register is read after being written.
+	unsigned lanes = 0;
+	if (vectorise)
+	{
+		if (Analysis::orderDependent(ast))
+		{
+			std::cerr << "Warning: not vectorising a kernel whose global registers depend on the order of the cells" << std::endl;
+		}
+		else
+		{
+			lanes = s.vectorWidth();
+		}
+	}
+	s.beginVectorCell(lanes);
+	if (lanes > 0)
+	{
+		ast->compile(s);
+	}
+	s.endVectorCell();
+}
+
+/**
+ * Compiles the AST for cells of either 16 or 8 bits, returning the address of
+ * the automaton function.
+ */
+static uint64_t compileAutomaton(AST::StatementList *ast,
+                                 int optimiseLevel,
+                                 bool vectorise,
+                                 Grid::Boundary boundary,
+                                 const std::string &path,
+                                 const std::string &cacheDirectory,
+                                 bool narrow,
+                                 std::unique_ptr<Code> &code,
+                                 Profile *profile)
+{
+	times = CompileTimes();
+	auto start = std::chrono::steady_clock::now();
+	initialiseTarget();
+	State s(path);
+	errorMessage = s.error;
+	if (!s.error.empty())
+	{
+		return 0;
+	}
+	s.profile = profile;
+	generateKernels(s, ast, vectorise, boundary, narrow);
+	s.finishProfile();
+	times.irGeneration = secondsSince(start);
+	// And then return the compiled version.  Instrumented code contains the
+	// address of the counts, so is no use to any other run.
+	std::unique_ptr<DiskCache> cache;
+	if (!cacheDirectory.empty() && !(profile && profile->instrument))
+	{
+		cache.reset(new DiskCache(cacheDirectory));
+		s.nameModule(optimiseLevel);
+	}
+	uint64_t address = s.getAutomaton("automaton", optimiseLevel,
+	                                   std::move(cache), code);
+	errorMessage = s.error;
+	return address;
+}
+
+automaton compile(AST::StatementList *ast,
+                  int optimiseLevel,
+                  bool vectorise,
+                  Grid::Boundary boundary,
+                  const std::string &path,
+                  const std::string &cacheDirectory,
+                  std::unique_ptr<Code> &code,
+                  Profile *profile)
+{
+	return reinterpret_cast<automaton>(compileAutomaton(ast, optimiseLevel,
+	                                   vectorise, boundary, path,
+	                                   cacheDirectory, false, code, profile));
+}
+
+narrowAutomaton compileNarrow(AST::StatementList *ast,
+                              int optimiseLevel,
+                              bool vectorise,
+                              Grid::Boundary boundary,
+                              const std::string &path,
+                              const std::string &cacheDirectory,
+                              std::unique_ptr<Code> &code,
+                              Profile *profile)
+{
+	return reinterpret_cast<narrowAutomaton>(compileAutomaton(ast,
+	                                         optimiseLevel, vectorise,
+	                                         boundary, path, cacheDirectory,
+	                                         true, code, profile));
+}
+
+bool Profile::load(const std::string &file)
+{
+	arms.clear();
+	counts.clear();
+	std::ifstream in(file);
+	std::string magic;
+	int version;
+	if (!(in >> magic >> version) || (magic != "cellatom-profile") ||
+	    (version != 1))
+	{
+		return false;
+	}
+	// Each line is the number of counts for a range expression, followed by
+	// the counts.
+	unsigned n;
+	while (in >> n)
+	{
+		arms.push_back(n);
+		for (unsigned i=0 ; i<n ; i++)
+		{
+			uint64_t c;
+			if (!(in >> c))
+			{
+				arms.clear();
+				counts.clear();
+				return false;
+			}
+			counts.push_back(c);
+		}
+	}
+	return true;
+}
+
+bool Profile::save(const std::string &file) const
+{
+	std::ofstream out(file);
+	out << "cellatom-profile 1\n";
+	size_t offset = 0;
+	for (unsigned n : arms)
+	{
+		out << n;
+		for (unsigned i=0 ; i<n ; i++)
+		{
+			out << ' ' << counts[offset++];
+		}
+		out << '\n';
+	}
+	out.close();
+	if (!out)
+	{
+		std::cerr << "Failed to write " << file << std::endl;
+		return false;
+	}
+	return true;
+}
+
+ensembleAutomaton compileEnsemble(AST::StatementList *ast,
+                                  int optimiseLevel,
+                                  Grid::Boundary boundary,
+                                  const std::string &path,
+                                  const std::string &cacheDirectory,
+                                  std::unique_ptr<Code> &code)
+{
+	times = CompileTimes();
+	auto start = std::chrono::steady_clock::now();
+	initialiseTarget();
 	State s(path);
+	errorMessage = s.error;
+	if (!s.error.empty())
+	{
+		return nullptr;
+	}
+	s.setEnsemble();
+	// Unlike the vector kernel for a single grid, each lane has its own
+	// global registers, so kernels that use them can still be vectorised.
+	// The truncated neighbourhoods at the edges of the grid are the same for
+	// every member, so the bounds checks are only needed there.
+	bool truncate = (boundary == Grid::Boundary::Truncate);
+	s.beginEnsembleCell("ensemble_cell", 0, !truncate);
 	ast->compile(s);
-	// And then return the compiled version.
-	return s.getAutomaton(optimiseLevel);
+	s.endEnsembleCell();
+	unsigned lanes = s.vectorWidth();
+	s.defineConstant("ensemble_lanes", lanes);
+	s.beginEnsembleCell("ensemble_vector", lanes, !truncate);
+	if (lanes > 0)
+	{
+		ast->compile(s);
+		s.endEnsembleCell();
+	}
+	else
+	{
+		// The runtime never calls the vector kernel, so leave it empty.
+		s.B.CreateRetVoid();
+	}
+	times.irGeneration = secondsSince(start);
+	std::unique_ptr<DiskCache> cache;
+	if (!cacheDirectory.empty())
+	{
+		cache.reset(new DiskCache(cacheDirectory));
+		s.nameModule(optimiseLevel);
+	}
+	uint64_t address = s.getAutomaton("ensemble", optimiseLevel,
+	                                   std::move(cache), code);
+	errorMessage = s.error;
+	return reinterpret_cast<ensembleAutomaton>(address);
+}
+
+/**
+ * Links an object file into a shared library with the system's C compiler
+ * driver.  Returns false, after reporting the error, if linking fails.
+ */
+static bool linkShared(const std::string &object, const std::string &library)
+{
+	const char *argv[] = { "cc", "-shared", "-o", library.c_str(),
+	                       object.c_str(), nullptr };
+	pid_t pid;
+	int status;
+	if ((posix_spawnp(&pid, argv[0], nullptr, nullptr,
+	                  const_cast<char**>(argv), environ) != 0) ||
+	    (waitpid(pid, &status, 0) != pid) ||
+	    !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+	{
+		std::cerr << "Failed to link " << library << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool compileToFile(AST::StatementList *ast,
+                   int optimiseLevel,
+                   bool vectorise,
+                   Grid::Boundary boundary,
+                   const std::string &path,
+                   const std::string &file)
+{
+	times = CompileTimes();
+	auto start = std::chrono::steady_clock::now();
+	initialiseTarget();
+	State s(path, true);
+	errorMessage = s.error;
+	if (!s.error.empty())
+	{
+		std::cerr << s.error << std::endl;
+		return false;
+	}
+	generateKernels(s, ast, vectorise, boundary, false);
+	// Give the entry point a name that won't clash with anything in the
+	// program that it is linked into.  Everything else is private.
+	s.Mod->getFunction("automaton")->setName("cellatom_automaton");
+	times.irGeneration = secondsSince(start);
+	start = std::chrono::steady_clock::now();
+	s.optimise(optimiseLevel);
+	times.optimisation = secondsSince(start);
+	start = std::chrono::steady_clock::now();
+	bool written;
+	if (!StringRef(file).endswith(".so"))
+	{
+		written = s.emit(file);
+	}
+	else
+	{
+		std::string object = file + "." + std::to_string(getpid()) + ".o";
+		written = s.emit(object) && linkShared(object, file);
+		sys::fs::remove(object);
+	}
+	times.codeGeneration = secondsSince(start);
+	return written;
 }
 
 } // namespace Compiler
@@ -281,12 +1310,28 @@ void LocalRegister::assign(Compiler::State &s, Value* val)
 Value* GlobalRegister::compile(Compiler::State &s)
 {
 	assert(registerNumber >= 0 && registerNumber < 10);
-	return s.B.CreateLoad(s.g[registerNumber]);
+	// Each lane of the ensemble kernels has its own global registers.  The
+	// lanes of the vector kernel for a single grid share them, but it is
+	// only generated if they are never written (or the writes are dead), so
+	// every lane sees the same value.
+	if ((s.lanes > 0) && !s.count)
+	{
+		return s.B.CreateVectorSplat(s.lanes,
+			s.B.CreateAlignedLoad(s.g[registerNumber], s.cellSize()));
+	}
+	return s.B.CreateAlignedLoad(s.g[registerNumber], s.cellSize());
 }
 void GlobalRegister::assign(Compiler::State &s, Value* val)
 {
 	assert(registerNumber >= 0 && registerNumber < 10);
-	s.B.CreateStore(val, s.g[registerNumber]);
+	// Nothing reads an unused register, so its value doesn't matter.
+	if (s.globalUses[registerNumber] == Analysis::GlobalUse::Unused)
+	{
+		return;
+	}
+	assert(((s.lanes == 0) || s.count) &&
+	       "Written global registers can't be vectorised");
+	s.B.CreateAlignedStore(val, s.g[registerNumber], s.cellSize());
 }
 Value* VRegister::compile(Compiler::State &s)
 {
@@ -340,6 +1385,12 @@ Value* Arithmetic::compile(Compiler::State &s)
 	return target->compile(s);
 }
 
+/**
+ * The largest number of values that a range expression can cover and still
+ * be compiled to a table lookup or a switch.
+ */
+static const int MaxRangeTable = 256;
+
 Value* RangeExpr::compile(Compiler::State &s)
 {
 	// Keep a reference to the builder so we don't have to type s.B everywhere
@@ -348,49 +1399,252 @@ Value* RangeExpr::compile(Compiler::State &s)
 	Function    *F = s.F;
 	// Load the register that we're mapping
 	Value *reg = value->compile(s);
+	// Each arm, and falling off the end, has a count in the profile.  Number
+	// the expression before deciding how to compile it, so that the numbers
+	// are the same however it is compiled.
+	unsigned arms = ranges.size() + 1;
+	size_t slot = s.profileSlot(this, arms);
+	bool counting = s.profile && s.profile->instrument;
+	// Returns an i1 (or a vector of i1) indicating whether the register
+	// matches the specified range.
+	auto compileMatch = [&](Range &re) -> Value*
+	{
+		// If there is just one range value then we just need an
+		// equals-comparison
+		if (re.start.get() == nullptr)
+		{
+			Value *val = re.end->compile(s);
+			return B.CreateICmpEQ(reg, val);
+		}
+		// Otherwise we need to emit both values and then compare if
+		// we're greater-than-or-equal-to the smaller, and
+		// less-than-or-equal-to the larger.
+		Value *min = re.start->compile(s);
+		Value *max = re.end->compile(s);
+		return B.CreateAnd(B.CreateICmpSGE(reg, min),
+		                   B.CreateICmpSLE(reg, max));
+	};
+	// Returns the first and last values that a range matches.  The
+	// comparisons are signed, and a range whose start is after its end
+	// matches nothing.
+	auto bounds = [&](size_t i)
+	{
+		const Range &re = *ranges[i];
+		int16_t end = re.end->value;
+		int16_t start = re.start.get() ? int16_t(re.start->value) : end;
+		return std::make_pair(start, end);
+	};
+	// If the ranges only cover a few values, then the value of the expression
+	// can be found without testing the ranges one at a time.
+	int low = INT16_MAX;
+	int high = INT16_MIN;
+	unsigned matching = 0;
+	bool literals = true;
+	for (size_t i=0 ; i<ranges.size() ; i++)
+	{
+		auto b = bounds(i);
+		if (b.first > b.second)
+		{
+			continue;
+		}
+		matching++;
+		low = std::min<int>(low, b.first);
+		high = std::max<int>(high, b.second);
+		literals &= (dynamic_cast<Literal*>(ranges[i]->value.get()) != nullptr);
+	}
+	int span = high - low + 1;
+	bool dense = (matching > 1) && (span <= MaxRangeTable);
+	// If every value is a literal, then look the result up in a table of the
+	// first match for each value.  This has no branches, and vectorises as a
+	// gather, although that only beats a compare and a select for each range
+	// if there are several ranges.  Counting the matches for a profile needs
+	// a branch for each range, so uses the code below.
+	if (dense && literals && !counting &&
+	    (matching >= ((s.lanes > 0) ? 4 : 2)))
+	{
+		std::vector<uint16_t> table(span, 0);
+		for (size_t i=ranges.size() ; i-->0 ; )
+		{
+			auto b = bounds(i);
+			if (b.first > b.second)
+			{
+				continue;
+			}
+			Literal *l = static_cast<Literal*>(ranges[i]->value.get());
+			for (int v=b.first ; v<=b.second ; v++)
+			{
+				table[v - low] = l->value;
+			}
+		}
+		return s.lookup(reg, low, table);
+	}
+	// In the vector kernel, each lane may match a different range, so we
+	// can't branch.  The values in a range map are expressions, which have no
+	// side effects, so evaluate all of them and then use selects to pick the
+	// first match in each lane, working backwards from the default of zero.
+	if (s.lanes > 0)
+	{
+		std::vector<std::pair<Value*, Value*>> cases;
+		for (const auto &re : ranges)
+		{
+			cases.push_back(std::make_pair(compileMatch(*re),
+			                               re->value->compile(s)));
+		}
+		Value *result = ConstantInt::get(s.regTy, 0);
+		for (auto i=cases.rbegin(), e=cases.rend() ; i!=e ; ++i)
+		{
+			result = B.CreateSelect(i->first, i->second, result);
+		}
+		return result;
+	}
+	const uint64_t *counts = s.profileCountsFor(slot);
+	// Branch weights are 32 bits, so scale the counts down if necessary.
+	unsigned shift = 0;
+	uint64_t remaining = 0;
+	if (counts)
+	{
+		uint64_t total = 0;
+		for (unsigned i=0 ; i<arms ; i++)
+		{
+			total += counts[i];
+		}
+		while ((total >> shift) > UINT32_MAX)
+		{
+			shift++;
+		}
+		for (unsigned i=0 ; i<arms ; i++)
+		{
+			remaining += counts[i] >> shift;
+		}
+	}
 	// Now create a basic block for continuation.  This is the block that
 	// will be reached after the range expression.
 	BasicBlock *cont = BasicBlock::Create(s.C, "range_continue", s.F);
 	// In this block, create a PHI node that contains the result.
 	PHINode *phi = PHINode::Create(s.regTy, ranges.size(),
 	                               "range_result", cont);
-	// Now loop over all of the possible ranges and create a test for each one
-	for (const auto &re : ranges)
+	// If the values aren't all literals, then a switch with a case for each
+	// value jumps straight to the code for the first range that matches it.
+	// The back end turns this into a jump table, or into a tree of
+	// comparisons that tests the most frequent cases first if there is a
+	// profile.
+	if (dense)
 	{
-		Value *match;
-		// If there is just one range value then we just need an
-		// equals-comparison
-		if (re->start.get() == nullptr)
+		BasicBlock *none = BasicBlock::Create(C, "range_default", F);
+		SwitchInst *sw = B.CreateSwitch(reg, none, span);
+		std::vector<bool> matched(span, false);
+		// The range for each case, for the branch weights.
+		std::vector<size_t> caseRanges;
+		std::vector<unsigned> caseCount(ranges.size(), 0);
+		for (size_t i=0 ; i<ranges.size() ; i++)
 		{
-			Value *val = re->end->compile(s);
-			match = B.CreateICmpEQ(reg, val);
+			auto b = bounds(i);
+			BasicBlock *expr = nullptr;
+			for (int v=b.first ; v<=b.second ; v++)
+			{
+				if (matched[v - low])
+				{
+					continue;
+				}
+				matched[v - low] = true;
+				if (!expr)
+				{
+					expr = BasicBlock::Create(C, "range_result", F);
+				}
+				sw->addCase(ConstantInt::get(s.cellTy, v, true), expr);
+				caseRanges.push_back(i);
+				caseCount[i]++;
+			}
+			// Ranges that are hidden by earlier ones need no code.
+			if (!expr)
+			{
+				continue;
+			}
+			B.SetInsertPoint(expr);
+			s.countProfile(slot, i);
+			Value *output = ranges[i]->value->compile(s);
+			phi->addIncoming(output, B.GetInsertBlock());
+			B.CreateBr(cont);
 		}
-		else
+		if (counts)
 		{
-			// Otherwise we need to emit both values and then compare if
-			// we're greater-than-or-equal-to the smaller, and
-			// less-than-or-equal-to the larger.
-			Value *min = re->start->compile(s);
-			Value *max = re->end->compile(s);
-			match = B.CreateAnd(B.CreateICmpSGE(reg, min),
-			                    B.CreateICmpSLE(reg, max));
+			// Spread the count for each range across its cases.
+			std::vector<uint32_t> weights;
+			weights.push_back(counts[arms - 1] >> shift);
+			for (size_t i : caseRanges)
+			{
+				weights.push_back((counts[i] >> shift) / caseCount[i]);
+			}
+			MDBuilder MDB(C);
+			sw->setMetadata(LLVMContext::MD_prof,
+			                MDB.createBranchWeights(weights));
 		}
+		B.SetInsertPoint(none);
+		s.countProfile(slot, arms - 1);
+		B.CreateBr(cont);
+		phi->addIncoming(ConstantInt::get(s.regTy, 0), none);
+		B.SetInsertPoint(cont);
+		return phi;
+	}
+	// Otherwise, test the ranges one at a time.  If no value can match more
+	// than one range, the ranges can be tested in any order, so test the ones
+	// that matched most often in the profile first.  Otherwise, the first
+	// match must win, so keep the order from the program.
+	std::vector<size_t> order;
+	for (size_t i=0 ; i<ranges.size() ; i++)
+	{
+		order.push_back(i);
+	}
+	bool disjoint = true;
+	for (size_t i=0 ; i<ranges.size() ; i++)
+	{
+		auto a = bounds(i);
+		for (size_t j=i+1 ; j<ranges.size() ; j++)
+		{
+			auto b = bounds(j);
+			if ((a.first <= a.second) && (b.first <= b.second) &&
+			    (a.first <= b.second) && (b.first <= a.second))
+			{
+				disjoint = false;
+			}
+		}
+	}
+	if (counts && disjoint)
+	{
+		std::stable_sort(order.begin(), order.end(),
+			[&](size_t a, size_t b) { return counts[a] > counts[b]; });
+	}
+	// Now loop over all of the possible ranges and create a test for each one
+	for (size_t i : order)
+	{
+		Range &re = *ranges[i];
+		Value *match = compileMatch(re);
 		// The match value is now a boolean (i1) indicating whether the
 		// value matches this range.  Create a pair of basic blocks, one
 		// for the case where we did match the specified range, and one for
 		// the case where we didn't.
 		BasicBlock *expr = BasicBlock::Create(C, "range_result", F);
 		BasicBlock *next = BasicBlock::Create(C, "range_next", F);
-		// Branch to the correct block
-		B.CreateCondBr(match, expr, next);
+		// Branch to the correct block, telling the optimisers how often each
+		// way was taken if we know.
+		BranchInst *br = B.CreateCondBr(match, expr, next);
+		if (counts)
+		{
+			uint64_t taken = counts[i] >> shift;
+			remaining -= taken;
+			MDBuilder MDB(C);
+			br->setMetadata(LLVMContext::MD_prof,
+			                MDB.createBranchWeights(taken, remaining));
+		}
 		// Now construct the block for the case where we matched a value
 		B.SetInsertPoint(expr);
+		s.countProfile(slot, i);
 		// Compiling the statement may emit some complex code, so we need to
 		// leave everything set up for it to (potentially) write lots of
 		// instructions and create more basic blocks (imagine nested range
 		// expressions).  If this is just a constant, then the next basic block
 		// will be empty, but the SimplifyCFG pass will remove it.
-		Value *output = re->value->compile(s);
+		Value *output = re.value->compile(s);
 		phi->addIncoming(output, B.GetInsertBlock());
 		//phi->addIncoming(re->value->compile(s), B.GetInsertBlock());
 		// Now that we've generated the correct value, branch to the
@@ -401,6 +1655,7 @@ Value* RangeExpr::compile(Compiler::State &s)
 	}
 	// If we've fallen off the end, set the default value of zero and branch to
 	// the continuation point.
+	s.countProfile(slot, arms - 1);
 	B.CreateBr(cont);
 	phi->addIncoming(ConstantInt::get(s.regTy, 0), B.GetInsertBlock());
 	B.SetInsertPoint(cont);
@@ -415,83 +1670,73 @@ Value* Neighbours::compile(Compiler::State &s)
 	Value *y = s.y;
 	Value *width = s.width;
 	Value *height = s.height;
-	Type  *regTy = s.regTy;
 	LLVMContext &C = s.C;
 	Function    *F = s.F;
-	// Some useful constants.
-	Value *Zero  = ConstantInt::get(regTy, 0);
-	Value *One  = ConstantInt::get(regTy, 1);
-	// For each of the (valid) neighbours Start by identifying the bounds
-	Value *XMin = B.CreateSub(x, One);
-	Value *XMax = B.CreateAdd(x, One);
-	Value *YMin = B.CreateSub(y, One);
-	Value *YMax = B.CreateAdd(y, One);
-	// Now clamp them to the grid
-	XMin = B.CreateSelect(B.CreateICmpSLT(XMin, Zero), x, XMin);
-	YMin = B.CreateSelect(B.CreateICmpSLT(YMin, Zero), y, YMin);
-	XMax = B.CreateSelect(B.CreateICmpSGE(XMax, width), x, XMax);
-	YMax = B.CreateSelect(B.CreateICmpSGE(YMax, height), y, YMax);
-
-	// Now create the loops.  We're going to create two nested loops, an outer
-	// one for x and an inner one for y.
-	BasicBlock *start = B.GetInsertBlock();
-	// The entry basic blocks for the outer and inner loops.
-	BasicBlock *xLoopStart = BasicBlock::Create(C, "x_loop_start", F);
-	BasicBlock *yLoopStart = BasicBlock::Create(C, "y_loop_start", F);
-	// Branch to the start of the outer loop and start inserting instructions there
-	B.CreateBr(xLoopStart);
-	B.SetInsertPoint(xLoopStart);
-	// Create the Phi node representing the x index and fill in its value for
-	// the initial entry into the loop.  We'll fill in its value for back
-	// branches later.
-	PHINode *XPhi = B.CreatePHI(regTy, 2);
-	XPhi->addIncoming(XMin, start);
-	// Branch to the inner loop and set up the y value in the same way.
-	B.CreateBr(yLoopStart);
-	B.SetInsertPoint(yLoopStart);
-	PHINode *YPhi = B.CreatePHI(regTy, 2);
-	YPhi->addIncoming(YMin, xLoopStart);
-
-	// Create basic blocks for the end of the inner (y) loop and for the loop body
-	BasicBlock *endY = BasicBlock::Create(C, "y_loop_end", F);
-	BasicBlock *body = BasicBlock::Create(C, "body", F);
-
-	// If we're in the (x,y) point, we're not in a neighbour, so skip the
-	// current loop iteration
-	B.CreateCondBr(B.CreateAnd(B.CreateICmpEQ(x, XPhi),
-	                           B.CreateICmpEQ(y, YPhi)),
-	               endY, body);
-	// Now we start emitting the body of the loop
-	B.SetInsertPoint(body);
-
-	// For larger grid sizes, we need to make sure that we're doing i32
-	// arithmetic, or we'll overflow
-	IntegerType *i32 = IntegerType::get(C, 32);
-	Value *x32 = B.CreateZExt(XPhi, i32);
-	Value *y32 = B.CreateZExt(YPhi, i32);
-	Value *height32 = B.CreateZExt(height, i32);
-	// Compute the address of the grid
-	Value *idx = B.CreateAdd(y32, B.CreateMul(x32, height32));
-
-	// Load the value at the current grid point into a0
-	B.CreateStore(B.CreateLoad(B.CreateGEP(s.oldGrid, idx)), s.a[0]);
-
-	// Compile each of the statements inside the loop
-	statements->compile(s);
-	// Branch to endY.  This is needed if any of the statements have created
-	// basic blocks.
-	B.CreateBr(endY);
-	B.SetInsertPoint(endY);
-	BasicBlock *endX = BasicBlock::Create(C, "x_loop_end", F);
-	BasicBlock *cont = BasicBlock::Create(C, "continue", F);
-	// Increment the loop country for the next iteration
-	YPhi->addIncoming(B.CreateAdd(YPhi, ConstantInt::get(regTy, 1)), endY);
-	B.CreateCondBr(B.CreateICmpEQ(YPhi, YMax), endX, yLoopStart);
-
-	B.SetInsertPoint(endX);
-	XPhi->addIncoming(B.CreateAdd(XPhi, ConstantInt::get(regTy, 1)), endX);
-	B.CreateCondBr(B.CreateICmpEQ(XPhi, XMax), cont, xLoopStart);
-	B.SetInsertPoint(cont);
+	// Some useful constants, of the same type as the coordinates.
+	Type  *indexTy = x->getType();
+	Value *Zero  = ConstantInt::get(indexTy, 0);
+	Value *One  = ConstantInt::get(indexTy, 1);
+	// The set of neighbours is fixed, so rather than generating a loop, emit a
+	// copy of the statements for each one, at a constant offset from the
+	// current cell.  Visit them in the same order as the interpreter.
+	for (int dx=-1 ; dx<=1 ; dx++)
+	{
+		for (int dy=-1 ; dy<=1 ; dy++)
+		{
+			if (dx == 0 && dy == 0)
+			{
+				continue;
+			}
+			// At the edges of the grid, some of the neighbours are missing,
+			// so skip the statements for them.  The other kernels are only
+			// run where every neighbour exists, so don't need this.
+			BasicBlock *next = nullptr;
+			if (!s.interior)
+			{
+				Value *valid = nullptr;
+				auto require = [&](Value *cond)
+				{
+					valid = valid ? B.CreateAnd(valid, cond) : cond;
+				};
+				if (dx < 0)
+				{
+					require(B.CreateICmpSGT(x, Zero));
+				}
+				if (dx > 0)
+				{
+					require(B.CreateICmpSLT(B.CreateAdd(x, One), width));
+				}
+				if (dy < 0)
+				{
+					require(B.CreateICmpSGT(y, Zero));
+				}
+				if (dy > 0)
+				{
+					require(B.CreateICmpSLT(B.CreateAdd(y, One), height));
+				}
+				BasicBlock *body = BasicBlock::Create(C, "neighbour", F);
+				next = BasicBlock::Create(C, "next_neighbour", F);
+				B.CreateCondBr(valid, body, next);
+				B.SetInsertPoint(body);
+			}
+			// Compute the address of the neighbour
+			Value *idx = s.gridIndex(dx, dy);
+			// Load the value of the neighbour into a0.  In the vector kernel,
+			// this is a vector of the neighbours of each lane.
+			Value *neighbour = (s.lanes > 0) ? s.loadVector(s.oldGrid, idx) :
+			                   B.CreateLoad(B.CreateGEP(s.oldGrid, idx));
+			B.CreateStore(neighbour, s.a[0]);
+			// Compile each of the statements for this neighbour
+			statements->compile(s);
+			// Branch to the next neighbour.  This is needed if any of the
+			// statements have created basic blocks.
+			if (next)
+			{
+				B.CreateBr(next);
+				B.SetInsertPoint(next);
+			}
+		}
+	}
 	return nullptr;
 }
 
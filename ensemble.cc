@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ensemble.hh"
+
+Ensemble::Ensemble(Grid::Coordinate w, Grid::Coordinate h, int members,
+                   Grid::Boundary b,
+                   int16_t value)
+	: width(w), height(h), count(members), boundary(b), edgeValue(value),
+	  cells(Grid::size(w, h) * members), next(Grid::size(w, h) * members)
+{
+}
+
+void Ensemble::load(int member, const int16_t *grid)
+{
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		for (Grid::Coordinate y=0 ; y<height ; y++)
+		{
+			size_t i = Grid::index(height, x, y);
+			cells[i * count + member] = grid[i];
+		}
+	}
+}
+
+void Ensemble::store(int member, int16_t *grid) const
+{
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		for (Grid::Coordinate y=0 ; y<height ; y++)
+		{
+			size_t i = Grid::index(height, x, y);
+			grid[i] = cells[i * count + member];
+		}
+	}
+}
+
+void Ensemble::step(ThreadPool &pool, const Kernel &kernel)
+{
+	Grid::fillHalo(cells.data(), width, height, boundary, edgeValue, count);
+	int threads = pool.size();
+	size_t registers = 10 * static_cast<size_t>(count);
+	if (globals.size() < registers * threads)
+	{
+		globals.resize(registers * threads);
+	}
+	auto bandStart = [&](int band) {
+		return static_cast<Grid::Coordinate>(width * band / threads);
+	};
+	pool.run([&](int band) {
+		kernel(cells.data(), next.data(), width, height, count,
+		       bandStart(band), bandStart(band+1), 0, height,
+		       &globals[registers * band]);
+	});
+	std::swap(cells, next);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_ENSEMBLE_H_INCLUDED
+#define CELLATOM_ENSEMBLE_H_INCLUDED
+#include <functional>
+#include <stdint.h>
+#include <vector>
+#include "grid.hh"
+#include "threadpool.hh"
+
+/**
+ * A set of independent grids of the same size, all run with the same program.
+ * The grids are interleaved (see grid.hh), so the copies of a cell in
+ * consecutive members are adjacent in memory, and the compiled ensemble kernel
+ * computes a cell in as many members as fit in a vector register at once.
+ * Every member has the same neighbourhood shape, so all of the lanes take the
+ * same path through the kernel, even at the edges of the grid.
+ *
+ * Each member has its own global registers.  As with the other engines, each
+ * call to the kernel starts them at zero.  Grids are converted to and from the
+ * normal layout with `load` and `store`.
+ */
+class Ensemble
+{
+	public:
+	/**
+	 * A function that runs one generation of the cells with x in [xStart,
+	 * xEnd) and y in [yStart, yEnd) of every member of an ensemble of `count`
+	 * grids.  This has the same arguments as the compiled ensemble automaton.
+	 */
+	typedef std::function<void(int16_t *oldgrid,
+	                           int16_t *newgrid,
+	                           Grid::Coordinate width,
+	                           Grid::Coordinate height,
+	                           int count,
+	                           Grid::Coordinate xStart,
+	                           Grid::Coordinate xEnd,
+	                           Grid::Coordinate yStart,
+	                           Grid::Coordinate yEnd,
+	                           int16_t *globals)> Kernel;
+	/**
+	 * Construct an ensemble of `count` empty grids of `width` by `height`
+	 * cells.  For constant boundaries, the neighbours beyond the edges have
+	 * the value `edgeValue`.
+	 */
+	Ensemble(Grid::Coordinate width,
+	         Grid::Coordinate height,
+	         int count,
+	         Grid::Boundary boundary,
+	         int16_t edgeValue);
+	/**
+	 * Copies the cells of member `member` from a grid in the normal layout.
+	 */
+	void load(int member, const int16_t *grid);
+	/**
+	 * Copies the cells of member `member` to a grid in the normal layout.  The
+	 * halo of the destination is not modified.
+	 */
+	void store(int member, int16_t *grid) const;
+	/**
+	 * Run one generation of every member, using `kernel`.  Each thread in the
+	 * pool computes a contiguous band of rows of every member.
+	 */
+	void step(ThreadPool &pool, const Kernel &kernel);
+	private:
+	/** The width of each grid */
+	Grid::Coordinate width;
+	/** The height of each grid */
+	Grid::Coordinate height;
+	/** The number of grids */
+	int count;
+	/** The boundary mode */
+	Grid::Boundary boundary;
+	/** The value of neighbours beyond the edges for constant boundaries */
+	int16_t edgeValue;
+	/** The current generation of every member, interleaved */
+	std::vector<int16_t> cells;
+	/** The next generation */
+	std::vector<int16_t> next;
+	/**
+	 * The global registers of every member, for each thread that has run a
+	 * band.  This grows to fit the largest pool that `step` is given.
+	 */
+	std::vector<int16_t> globals;
+};
+
+#endif // CELLATOM_ENSEMBLE_H_INCLUDED
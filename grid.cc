@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "grid.hh"
+
+namespace Grid
+{
+
+template<typename Cell>
+void fillHalo(Cell *grid,
+              Coordinate width,
+              Coordinate height,
+              Boundary boundary,
+              int16_t value,
+              int members)
+{
+	if (boundary == Boundary::Truncate)
+	{
+		return;
+	}
+	// Sets the halo cell at (x, y) in every member.  For wrapped grids, the
+	// value is that of the cell on the opposite edge, which is never itself
+	// in the halo.
+	auto edge = [&](Coordinate x, Coordinate y)
+	{
+		Cell *dst = &grid[static_cast<size_t>(index(height, x, y)) * members];
+		const Cell *src = &grid[static_cast<size_t>(index(height,
+			(x + width) % width, (y + height) % height)) * members];
+		for (int m=0 ; m<members ; m++)
+		{
+			dst[m] = (boundary == Boundary::Constant) ?
+				static_cast<Cell>(value) : src[m];
+		}
+	};
+	// The first and last rows, including the corners.
+	for (Coordinate y=-1 ; y<=height ; y++)
+	{
+		edge(-1, y);
+		edge(width, y);
+	}
+	// The first and last cells of every other row.
+	for (Coordinate x=0 ; x<width ; x++)
+	{
+		edge(x, -1);
+		edge(x, height);
+	}
+}
+
+template void fillHalo(int16_t *, Coordinate, Coordinate, Boundary, int16_t,
+                       int);
+template void fillHalo(int8_t *, Coordinate, Coordinate, Boundary, int16_t,
+                       int);
+
+}  // namespace Grid
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_GRID_H_INCLUDED
+#define CELLATOM_GRID_H_INCLUDED
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The in-memory layout of grids.  Grids are stored in x-major order with a
+ * one-cell ghost border (the halo) around them, so every cell, including those
+ * on the edges, has all eight neighbours in memory.  The halo is filled in
+ * before each generation, according to the boundary mode.
+ *
+ * An ensemble of grids of the same size is stored as a single array in which
+ * the grids are interleaved: each cell of the first grid is followed by the
+ * same cell in each of the others, so the cell at index `i` of member `m` of
+ * an ensemble of `members` grids is at `i * members + m`.
+ */
+namespace Grid
+{
+	/**
+	 * The type of the coordinates of cells and of the width and height of
+	 * grids.  Large grids have more than 2^31 cells, so this is wide enough
+	 * to hold the index of any cell too.
+	 */
+	typedef int64_t Coordinate;
+	/**
+	 * How the neighbourhoods of the cells at the edges of the grid are
+	 * treated.  This is fixed when the kernel is compiled.
+	 */
+	enum class Boundary
+	{
+		/**
+		 * Neighbours outside the grid don't exist, so the neighbours statement
+		 * skips them.  This is the default.
+		 */
+		Truncate,
+		/** The edges of the grid wrap around, forming a torus. */
+		Wrap,
+		/** Every neighbour outside the grid has the same value. */
+		Constant
+	};
+	/**
+	 * The distance between the starts of adjacent rows in a grid with the
+	 * specified height.
+	 */
+	inline Coordinate stride(Coordinate height)
+	{
+		return height + 2;
+	}
+	/**
+	 * The index of the cell at (x, y).  Either coordinate may be one beyond
+	 * the edge of the grid, giving the index of a cell in the halo.
+	 */
+	inline Coordinate index(Coordinate height, Coordinate x, Coordinate y)
+	{
+		return (x + 1) * stride(height) + y + 1;
+	}
+	/**
+	 * The number of cells, including the halo, to allocate for a grid.
+	 */
+	inline size_t size(Coordinate width, Coordinate height)
+	{
+		return static_cast<size_t>(width + 2) * stride(height);
+	}
+	/**
+	 * Fill in the halo of a grid from its contents.  For constant boundaries,
+	 * every cell in the halo is set to `value`.  Nothing reads the halo when
+	 * neighbourhoods are truncated, so this does nothing.  Grids may have
+	 * either 16-bit or 8-bit cells.  If `members` is more than one, then
+	 * `grid` is an ensemble and the halo of every member is filled in.
+	 */
+	template<typename Cell>
+	void fillHalo(Cell *grid,
+	              Coordinate width,
+	              Coordinate height,
+	              Boundary boundary,
+	              int16_t value,
+	              int members=1);
+}
+
+#endif // CELLATOM_GRID_H_INCLUDED
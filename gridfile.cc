@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "gridfile.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace GridFile
+{
+
+static const char magic[8] = { 'C', 'E', 'L', 'L', 'A', 'T', 'O', 'M' };
+
+/**
+ * Maps `length` bytes of the open file `fd` into memory, reporting any error.
+ * Returns null on failure.
+ */
+static void *mapFile(int fd, size_t length, int flags, const char *file)
+{
+	void *addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		std::cerr << "Failed to map " << file << ": " << strerror(errno)
+		          << std::endl;
+		return nullptr;
+	}
+	return addr;
+}
+
+void initialise(Header &h,
+                Grid::Coordinate width,
+                Grid::Coordinate height,
+                Encoding encoding)
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = 2;
+	h.cellSize = sizeof(int16_t);
+	h.width = width;
+	h.height = height;
+	h.encoding = encoding;
+}
+
+MappedGrid::~MappedGrid()
+{
+	if (base)
+	{
+		munmap(base, length);
+	}
+}
+
+bool MappedGrid::open(const char *file)
+{
+	int fd = ::open(file, O_RDONLY);
+	struct stat st;
+	if ((fd < 0) || (fstat(fd, &st) != 0))
+	{
+		std::cerr << "Failed to open " << file << ": " << strerror(errno)
+		          << std::endl;
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+	length = st.st_size;
+	if (length < sizeof(Header))
+	{
+		std::cerr << file << " is not a grid file" << std::endl;
+		close(fd);
+		return false;
+	}
+	// The mapping is private, so the engines can write to it as if it were
+	// any other grid.  Only the pages that they write to are copied.
+	base = mapFile(fd, length, MAP_PRIVATE, file);
+	close(fd);
+	if (!base)
+	{
+		return false;
+	}
+	Header &h = header();
+	if ((memcmp(h.magic, magic, sizeof(magic)) != 0) ||
+	    (h.version != 2))
+	{
+		std::cerr << file << " is not a grid file" << std::endl;
+		return false;
+	}
+	if (h.encoding != Layout)
+	{
+		std::cerr << file << " does not store the cells in place" << std::endl;
+		return false;
+	}
+	if (h.cellSize != sizeof(int16_t))
+	{
+		std::cerr << file << " does not have 16-bit cells" << std::endl;
+		return false;
+	}
+	// Compare by dividing, so that a corrupt size can't overflow.
+	Grid::Coordinate cells = (length - sizeof(Header)) / h.cellSize;
+	if ((h.width < 1) || (h.height < 1) || (h.width + 2 > cells) ||
+	    (h.height + 2 > cells / (h.width + 2)))
+	{
+		std::cerr << file << " is too short for its grid" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool MappedGrid::create(const char *file,
+                        Grid::Coordinate width,
+                        Grid::Coordinate height)
+{
+	int fd = ::open(file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	length = sizeof(Header) + Grid::size(width, height) * sizeof(int16_t);
+	// Extending the file fills it with zeroes, so the grid and the unused
+	// parts of the header don't need to be written.
+	if ((fd < 0) || (ftruncate(fd, length) != 0))
+	{
+		std::cerr << "Failed to create " << file << ": " << strerror(errno)
+		          << std::endl;
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+	base = mapFile(fd, length, MAP_SHARED, file);
+	close(fd);
+	if (!base)
+	{
+		return false;
+	}
+	initialise(header(), width, height, Layout);
+	return true;
+}
+
+} // namespace GridFile
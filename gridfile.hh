@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_GRIDFILE_H_INCLUDED
+#define CELLATOM_GRIDFILE_H_INCLUDED
+#include <stddef.h>
+#include <stdint.h>
+#include "grid.hh"
+
+/**
+ * Grids stored in binary files.  A file is a fixed-size header followed by the
+ * cells, in the in-memory layout described in grid.hh (including the halo), so
+ * a mapped file can be used directly as a grid by any of the engines.  All of
+ * the fields and cells are in the byte order of the machine that wrote the
+ * file.
+ */
+namespace GridFile
+{
+	/**
+	 * The ways in which the cells after a header can be stored.
+	 */
+	enum Encoding : uint16_t
+	{
+		/**
+		 * The cells are stored in the in-memory layout, including the halo.
+		 * Grid files always use this.
+		 */
+		Layout = 0,
+		/**
+		 * The cells, excluding the halo, are stored in x-major order as runs
+		 * of equal values.  Each run is a `uint16_t` length followed by the
+		 * `int16_t` value, and the runs cover exactly `width * height` cells.
+		 * Snapshots use this.
+		 */
+		RunLength = 1
+	};
+	/**
+	 * The header at the start of every grid file.  It is 64 bytes long, so
+	 * the cells that follow it are suitably aligned.
+	 */
+	struct Header
+	{
+		/** The characters `CELLATOM`, identifying the file type */
+		char magic[8];
+		/**
+		 * The version of the format, currently 2.  Files with any other
+		 * version are rejected.
+		 */
+		uint32_t version;
+		/** The size of each cell, in bytes.  Currently always 2. */
+		uint16_t cellSize;
+		/** How the cells are stored: one of the `Encoding` values */
+		uint16_t encoding;
+		/** The width of the grid */
+		int64_t width;
+		/** The height of the grid */
+		int64_t height;
+		/** The number of generations that have been run on the grid */
+		uint64_t generation;
+		/**
+		 * The global registers.  Every generation starts with them at zero,
+		 * so the engines don't carry them from one generation to the next,
+		 * and files written by cellatom always store zero.
+		 */
+		int16_t globals[10];
+		/** Padding to the size of the header, must be zero */
+		uint8_t padding[4];
+	};
+	static_assert(sizeof(Header) == 64, "Grid file header has the wrong size");
+
+	/**
+	 * Fills in a header for a grid of `width` by `height` 16-bit cells, stored
+	 * with the specified encoding, with no generations run.
+	 */
+	void initialise(Header &h,
+	                Grid::Coordinate width,
+	                Grid::Coordinate height,
+	                Encoding encoding);
+
+	/**
+	 * A grid file mapped into memory.  The mapping is removed when this is
+	 * destroyed, so the cells must not be used after that.
+	 */
+	class MappedGrid
+	{
+		public:
+		MappedGrid() : base(nullptr), length(0) {}
+		~MappedGrid();
+		/**
+		 * Maps an existing grid file.  The mapping is private, so changes to
+		 * the cells are not written back to the file.  Returns false, after
+		 * reporting the error, if the file can't be mapped or isn't a grid
+		 * file with 16-bit cells.
+		 */
+		bool open(const char *file);
+		/**
+		 * Creates (or replaces) a grid file for a grid of `width` by `height`
+		 * cells, all zero, and maps it.  Changes to the header and the cells
+		 * are written back to the file.  Returns false, after reporting the
+		 * error, if the file can't be created.
+		 */
+		bool create(const char *file,
+		            Grid::Coordinate width,
+		            Grid::Coordinate height);
+		/**
+		 * The header of the file.
+		 */
+		Header &header()
+		{
+			return *static_cast<Header*>(base);
+		}
+		/**
+		 * The cells of the grid, including the halo.
+		 */
+		int16_t *cells()
+		{
+			return reinterpret_cast<int16_t*>(static_cast<char*>(base) +
+			                                  sizeof(Header));
+		}
+		private:
+		/** The address of the mapping, or null if there isn't one */
+		void *base;
+		/** The length of the mapping */
+		size_t length;
+	};
+}
+
+#endif // CELLATOM_GRIDFILE_H_INCLUDED
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "hashlife.hh"
+#include <algorithm>
+#include <assert.h>
+
+namespace HashLife
+{
+
+Universe::Universe(Step s, Grid::Boundary b, int16_t e, size_t max)
+	: step(s), boundary(b), edgeValue(e), maxNodes(max)
+{
+	assert(boundary != Grid::Boundary::Wrap);
+}
+
+void Universe::load(const int16_t *grid, Grid::Coordinate w,
+                    Grid::Coordinate h)
+{
+	width = w;
+	height = h;
+	// Start with the smallest root that has the grid in its centre.
+	int level = 2;
+	while ((int64_t(1) << (level - 1)) < std::max(width, height))
+	{
+		level++;
+	}
+	offset = int64_t(1) << (level - 2);
+	root = build(grid, level, -offset, -offset);
+}
+
+void Universe::run(uint64_t generations)
+{
+	// Run for each power of two in the number of generations.
+	for (int stepSize=0 ; generations != 0 ; stepSize++, generations >>= 1)
+	{
+		if (!(generations & 1))
+		{
+			continue;
+		}
+		// The root must be large enough to run forward by this many steps.
+		// It is surrounded by Outside cells, so growing it doesn't change
+		// anything.
+		while (root->level < stepSize + 2)
+		{
+			offset += int64_t(1) << (root->level - 1);
+			root = expand(root);
+		}
+		// The result is the centre of the root, which contains the grid.
+		// Grow it back to the same size so that the grid stays in the centre.
+		offset -= int64_t(1) << (root->level - 2);
+		root = advance(root, stepSize);
+		offset += int64_t(1) << (root->level - 1);
+		root = expand(root);
+		// Only the root is in use between steps, so this is the only place
+		// where nodes can be moved.  Keeping the memoised results is what
+		// makes later steps fast, so only forget them if the nodes that
+		// they keep alive still take up most of the space.
+		if (nodes.size() > maxNodes)
+		{
+			collect(true);
+			if (nodes.size() > maxNodes / 2)
+			{
+				collect(false);
+			}
+		}
+	}
+}
+
+void Universe::store(int16_t *grid)
+{
+	read(root, -offset, -offset, grid);
+}
+
+Node *Universe::leaf(int32_t value)
+{
+	Node *&n = leaves[value];
+	if (!n)
+	{
+		nodes.push_back(Node());
+		n = &nodes.back();
+		n->level = 0;
+		n->value = value;
+		n->result = nullptr;
+	}
+	return n;
+}
+
+Node *Universe::join(Node *c00, Node *c01, Node *c10, Node *c11)
+{
+	Node *&n = interior[{{c00, c01, c10, c11}}];
+	if (!n)
+	{
+		nodes.push_back(Node());
+		n = &nodes.back();
+		n->level = c00->level + 1;
+		n->value = Outside;
+		n->child[0][0] = c00;
+		n->child[0][1] = c01;
+		n->child[1][0] = c10;
+		n->child[1][1] = c11;
+		n->result = nullptr;
+	}
+	return n;
+}
+
+Node *Universe::outside(int level)
+{
+	while (static_cast<int>(outsideNodes.size()) <= level)
+	{
+		if (outsideNodes.empty())
+		{
+			outsideNodes.push_back(leaf(Outside));
+			continue;
+		}
+		Node *o = outsideNodes.back();
+		outsideNodes.push_back(join(o, o, o, o));
+	}
+	return outsideNodes[level];
+}
+
+Node *Universe::expand(Node *n)
+{
+	Node *o = outside(n->level - 1);
+	return join(join(o, o, o, n->child[0][0]),
+	            join(o, o, n->child[0][1], o),
+	            join(o, n->child[1][0], o, o),
+	            join(n->child[1][1], o, o, o));
+}
+
+Node *Universe::centre(Node *n)
+{
+	return join(n->child[0][0]->child[1][1],
+	            n->child[0][1]->child[1][0],
+	            n->child[1][0]->child[0][1],
+	            n->child[1][1]->child[0][0]);
+}
+
+Node *Universe::advance(Node *n, int stepSize)
+{
+	assert(stepSize <= n->level - 2);
+	bool full = (stepSize == n->level - 2);
+	if (full && n->result)
+	{
+		return n->result;
+	}
+	if (!full)
+	{
+		if (slowStep != stepSize)
+		{
+			slowResults.clear();
+			slowStep = stepSize;
+		}
+		auto cached = slowResults.find(n);
+		if (cached != slowResults.end())
+		{
+			return cached->second;
+		}
+	}
+	Node *result;
+	if (n->level == 2)
+	{
+		result = advanceLeaves(n);
+	}
+	else
+	{
+		// The grandchildren of this node, in a 4x4 grid indexed by x and then
+		// y.
+		Node *g[4][4];
+		for (int x=0 ; x<4 ; x++)
+		{
+			for (int y=0 ; y<4 ; y++)
+			{
+				g[x][y] = n->child[x/2][y/2]->child[x%2][y%2];
+			}
+		}
+		// Split the node into nine overlapping nodes one level down, and find
+		// their centres.  For a full step, run each of them forward by half
+		// of the step, otherwise don't run them at all.
+		Node *r[3][3];
+		for (int x=0 ; x<3 ; x++)
+		{
+			for (int y=0 ; y<3 ; y++)
+			{
+				Node *sub = join(g[x][y], g[x][y+1], g[x+1][y], g[x+1][y+1]);
+				r[x][y] = full ? advance(sub, stepSize - 1) : centre(sub);
+			}
+		}
+		// Combine those into four nodes covering the centre, and run each of
+		// them forward by (the rest of) the step.
+		Node *q[2][2];
+		for (int x=0 ; x<2 ; x++)
+		{
+			for (int y=0 ; y<2 ; y++)
+			{
+				Node *sub = join(r[x][y], r[x][y+1], r[x+1][y], r[x+1][y+1]);
+				q[x][y] = advance(sub, full ? stepSize - 1 : stepSize);
+			}
+		}
+		result = join(q[0][0], q[0][1], q[1][0], q[1][1]);
+	}
+	if (full)
+	{
+		n->result = result;
+	}
+	else
+	{
+		slowResults[n] = result;
+	}
+	return result;
+}
+
+Node *Universe::advanceLeaves(Node *n)
+{
+	// The values of the 4x4 cells in this node, indexed by x and then y.
+	int32_t cells[4][4];
+	// The cells that are inside the grid form a rectangle.  Find it.
+	int x0 = 4, x1 = 0, y0 = 4, y1 = 0;
+	for (int x=0 ; x<4 ; x++)
+	{
+		for (int y=0 ; y<4 ; y++)
+		{
+			cells[x][y] = n->child[x/2][y/2]->child[x%2][y%2]->value;
+			if (cells[x][y] != Outside)
+			{
+				x0 = std::min(x0, x);
+				x1 = std::max(x1, x + 1);
+				y0 = std::min(y0, y);
+				y1 = std::max(y1, y + 1);
+			}
+		}
+	}
+	// Outside cells never change, so if the centre is entirely outside the
+	// grid then there is nothing to compute.
+	if ((cells[1][1] == Outside) && (cells[1][2] == Outside) &&
+	    (cells[2][1] == Outside) && (cells[2][2] == Outside))
+	{
+		Node *o = leaf(Outside);
+		return join(o, o, o, o);
+	}
+	// Run one step on a small grid containing the cells.  With truncated
+	// neighbourhoods, this grid is just the rectangle that is inside the
+	// grid, so that the kernel sees the edges in the same places.  With
+	// constant edges, it is the whole node, with the Outside cells given the
+	// value of the edges.  Either way, every neighbour of the centre cells is
+	// in the small grid.
+	if (boundary == Grid::Boundary::Constant)
+	{
+		x0 = 0, x1 = 4, y0 = 0, y1 = 4;
+	}
+	int16_t w = x1 - x0;
+	int16_t h = y1 - y0;
+	for (int x=x0 ; x<x1 ; x++)
+	{
+		for (int y=y0 ; y<y1 ; y++)
+		{
+			int32_t v = cells[x][y];
+			oldWindow[Grid::index(h, x - x0, y - y0)] =
+				(v == Outside) ? edgeValue : static_cast<int16_t>(v);
+		}
+	}
+	Grid::fillHalo(oldWindow, w, h, boundary, edgeValue);
+	step(oldWindow, newWindow, w, h);
+	Node *r[2][2];
+	for (int x=1 ; x<3 ; x++)
+	{
+		for (int y=1 ; y<3 ; y++)
+		{
+			r[x-1][y-1] = (cells[x][y] == Outside) ? leaf(Outside) :
+				leaf(static_cast<uint16_t>(newWindow[Grid::index(h, x - x0, y - y0)]));
+		}
+	}
+	return join(r[0][0], r[0][1], r[1][0], r[1][1]);
+}
+
+Node *Universe::build(const int16_t *grid, int level, int64_t x, int64_t y)
+{
+	int64_t size = int64_t(1) << level;
+	if ((x >= width) || (y >= height) || (x + size <= 0) || (y + size <= 0))
+	{
+		return outside(level);
+	}
+	if (level == 0)
+	{
+		return leaf(static_cast<uint16_t>(grid[Grid::index(height, x, y)]));
+	}
+	int64_t half = size / 2;
+	return join(build(grid, level - 1, x, y),
+	            build(grid, level - 1, x, y + half),
+	            build(grid, level - 1, x + half, y),
+	            build(grid, level - 1, x + half, y + half));
+}
+
+void Universe::read(Node *n, int64_t x, int64_t y, int16_t *grid)
+{
+	int64_t size = int64_t(1) << n->level;
+	if ((x >= width) || (y >= height) || (x + size <= 0) || (y + size <= 0))
+	{
+		return;
+	}
+	if (n->level == 0)
+	{
+		assert(n->value != Outside);
+		grid[Grid::index(height, x, y)] = n->value;
+		return;
+	}
+	int64_t half = size / 2;
+	read(n->child[0][0], x, y, grid);
+	read(n->child[0][1], x, y + half, grid);
+	read(n->child[1][0], x + half, y, grid);
+	read(n->child[1][1], x + half, y + half, grid);
+}
+
+void Universe::mark(Node *n,
+                    bool keepResults,
+                    std::unordered_map<Node*, Node*> &kept)
+{
+	if (!n || !kept.insert({n, nullptr}).second)
+	{
+		return;
+	}
+	if (n->level > 0)
+	{
+		mark(n->child[0][0], keepResults, kept);
+		mark(n->child[0][1], keepResults, kept);
+		mark(n->child[1][0], keepResults, kept);
+		mark(n->child[1][1], keepResults, kept);
+	}
+	if (keepResults)
+	{
+		mark(n->result, keepResults, kept);
+	}
+}
+
+void Universe::collect(bool keepResults)
+{
+	// Nodes are stored by value, so the ones that are kept are copied into
+	// new storage, and then every pointer is redirected to the copies.  The
+	// recursion is only as deep as the root's level, because children and
+	// results are always one level lower.
+	std::unordered_map<Node*, Node*> kept;
+	mark(root, keepResults, kept);
+	for (Node *o : outsideNodes)
+	{
+		mark(o, keepResults, kept);
+	}
+	std::deque<Node> live;
+	for (auto &k : kept)
+	{
+		live.push_back(*k.first);
+		k.second = &live.back();
+	}
+	leaves.clear();
+	interior.clear();
+	for (Node &n : live)
+	{
+		if (n.level == 0)
+		{
+			leaves[n.value] = &n;
+		}
+		else
+		{
+			for (int x=0 ; x<2 ; x++)
+			{
+				for (int y=0 ; y<2 ; y++)
+				{
+					n.child[x][y] = kept[n.child[x][y]];
+				}
+			}
+			interior[{{n.child[0][0], n.child[0][1], n.child[1][0],
+			           n.child[1][1]}}] = &n;
+		}
+		auto result = kept.find(n.result);
+		n.result = (result != kept.end()) ? result->second : nullptr;
+	}
+	for (Node *&o : outsideNodes)
+	{
+		o = kept[o];
+	}
+	root = kept[root];
+	// The slow results are keyed by the old nodes, so start them again.
+	slowResults.clear();
+	slowStep = -1;
+	nodes.swap(live);
+}
+
+}  // namespace HashLife
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_HASHLIFE_H_INCLUDED
+#define CELLATOM_HASHLIFE_H_INCLUDED
+#include <array>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "grid.hh"
+
+/**
+ * A HashLife engine.  The grid is stored as a quadtree in which identical
+ * subtrees are shared, and the result of running each subtree forward is
+ * memoised, so large, repetitive patterns can be advanced by many generations
+ * at once.
+ *
+ * HashLife relies on the next value of a cell depending only on its
+ * neighbourhood, so it can't be used for kernels whose global registers depend
+ * on the order of the cells.
+ *
+ * The cells beyond the edges of the grid are stored in the tree as `Outside`
+ * cells, which never change.  For truncated boundaries, the cells that are
+ * inside the grid are computed as if Outside cells weren't there, so this
+ * gives the same result as the other engines.
+ */
+namespace HashLife
+{
+	/**
+	 * The value of a leaf that is outside the grid.  Leaves inside the grid
+	 * hold the (unsigned) value of the cell.
+	 */
+	const int32_t Outside = -1;
+
+	/**
+	 * The default number of nodes that a universe may hold before the ones
+	 * that are no longer reachable from the root are collected.  Each node
+	 * takes roughly 100 bytes, including its entry in the hash table.
+	 */
+	const size_t MaxNodes = 1 << 21;
+
+	/**
+	 * A node in the quadtree.  Nodes are immutable once created.
+	 */
+	struct Node
+	{
+		/**
+		 * The level of the node.  A node at level k covers a square with
+		 * sides of 2^k cells.  Leaves are at level 0.
+		 */
+		int level;
+		/** The value of the cell, for leaves */
+		int32_t value;
+		/**
+		 * The four quadrants, indexed by x and then y, for non-leaf nodes.
+		 */
+		Node *child[2][2];
+		/**
+		 * The memoised result of running the centre of this node, which is a
+		 * node one level lower, forward by 2^(level-2) generations.
+		 */
+		Node *result;
+	};
+
+	/**
+	 * A grid stored as a quadtree.
+	 */
+	class Universe
+	{
+		public:
+		/**
+		 * A function that runs any of the engines for one step over a whole
+		 * grid.  The grids have a halo, which is filled in before the call.
+		 */
+		typedef std::function<void(int16_t *oldgrid,
+		                           int16_t *newgrid,
+		                           Grid::Coordinate width,
+		                           Grid::Coordinate height)> Step;
+		/**
+		 * Construct a universe that uses `step` to find the next value of
+		 * each cell.  The boundary mode must be `Truncate` or `Constant`.
+		 * Unreachable nodes are collected when there are more than
+		 * `maxNodes`.
+		 */
+		Universe(Step step,
+		         Grid::Boundary boundary,
+		         int16_t edgeValue,
+		         size_t maxNodes=MaxNodes);
+		/**
+		 * Replace the contents of the universe with a grid.
+		 */
+		void load(const int16_t *grid,
+		          Grid::Coordinate width,
+		          Grid::Coordinate height);
+		/**
+		 * Run the universe forward by the specified number of generations.
+		 */
+		void run(uint64_t generations);
+		/**
+		 * Copy the contents of the universe back to a grid with the same
+		 * dimensions as the one passed to `load`.  The halo is not modified.
+		 */
+		void store(int16_t *grid);
+		private:
+		/**
+		 * Returns the leaf with the specified value.
+		 */
+		Node *leaf(int32_t value);
+		/**
+		 * Returns the node with the specified quadrants, each indexed by x
+		 * and then y.
+		 */
+		Node *join(Node *c00, Node *c01, Node *c10, Node *c11);
+		/**
+		 * Returns a node at the specified level that is entirely outside the
+		 * grid.
+		 */
+		Node *outside(int level);
+		/**
+		 * Returns a node one level higher than `n`, with `n` in the centre.
+		 */
+		Node *expand(Node *n);
+		/**
+		 * Returns the centre of `n`, one level lower, without running it.
+		 */
+		Node *centre(Node *n);
+		/**
+		 * Returns the centre of `n`, one level lower, after running it for
+		 * 2^step generations.  The step must be at most `n->level - 2`.
+		 */
+		Node *advance(Node *n, int step);
+		/**
+		 * Computes the result of a level 2 node, which is the centre 2x2 cells
+		 * after one generation, by running the step function.
+		 */
+		Node *advanceLeaves(Node *n);
+		/**
+		 * Build the node at the specified level whose first cell is at (x, y)
+		 * relative to the grid.
+		 */
+		Node *build(const int16_t *grid, int level, int64_t x, int64_t y);
+		/**
+		 * Copy the cells of `n`, whose first cell is at (x, y) relative to
+		 * the grid, to a grid.
+		 */
+		void read(Node *n, int64_t x, int64_t y, int16_t *grid);
+		/**
+		 * Adds `n`, and every node that it refers to, to `kept`.  If
+		 * `keepResults` is true, then memoised results are followed too.
+		 */
+		void mark(Node *n,
+		          bool keepResults,
+		          std::unordered_map<Node*, Node*> &kept);
+		/**
+		 * Frees every node that can't be reached from the root.  If
+		 * `keepResults` is true, then the memoised results of the nodes that
+		 * are kept are also kept, otherwise they are forgotten.
+		 */
+		void collect(bool keepResults);
+		/**
+		 * Hash function for the children of a node.
+		 */
+		struct ChildrenHash
+		{
+			size_t operator()(const std::array<Node*, 4> &c) const
+			{
+				size_t h = 0;
+				for (Node *n : c)
+				{
+					h = h * 31 + std::hash<Node*>()(n);
+				}
+				return h;
+			}
+		};
+		/** The function used to compute the next value of cells */
+		Step step;
+		/** How the neighbourhoods of cells at the edges are treated */
+		Grid::Boundary boundary;
+		/** The value of neighbours outside the grid for constant boundaries */
+		int16_t edgeValue;
+		/** The number of nodes above which unreachable ones are collected */
+		size_t maxNodes;
+		/** Storage for all of the nodes */
+		std::deque<Node> nodes;
+		/** The leaves, indexed by value */
+		std::unordered_map<int32_t, Node*> leaves;
+		/** The non-leaf nodes, indexed by their children */
+		std::unordered_map<std::array<Node*, 4>, Node*, ChildrenHash> interior;
+		/** The nodes that are entirely outside the grid, indexed by level */
+		std::vector<Node*> outsideNodes;
+		/**
+		 * Memoised results of advancing nodes by fewer than 2^(level-2)
+		 * generations.  These are only valid for `slowStep`.
+		 */
+		std::unordered_map<Node*, Node*> slowResults;
+		/** The step for which `slowResults` are valid */
+		int slowStep = -1;
+		/** The root of the tree */
+		Node *root = nullptr;
+		/**
+		 * The position of the first cell of the grid within the root.  This
+		 * always places the grid within the centre of the root.
+		 */
+		int64_t offset = 0;
+		/** The width of the grid */
+		Grid::Coordinate width = 0;
+		/** The height of the grid */
+		Grid::Coordinate height = 0;
+		/** The old grid used by `advanceLeaves` */
+		int16_t oldWindow[(4+2)*(4+2)];
+		/** The new grid used by `advanceLeaves` */
+		int16_t newWindow[(4+2)*(4+2)];
+	};
+}
+
+#endif // CELLATOM_HASHLIFE_H_INCLUDED
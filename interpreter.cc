@@ -37,33 +37,41 @@ struct State
   /** The current cell value */
   int16_t v = 0;
   /** The width of the grid */
-  int16_t width = 0;
+  Grid::Coordinate width = 0;
   /** The height of the grid */
-  int16_t height = 0;
+  Grid::Coordinate height = 0;
   /** The x coordinate of the current cell */
-  int16_t x = 0;
+  Grid::Coordinate x = 0;
   /** The y coordinate of the current cell */
-  int16_t y = 0;
+  Grid::Coordinate y = 0;
   /** The grid itself (non-owning pointer) */
   int16_t *grid = 0;
+  /** Whether neighbourhoods are truncated at the edges of the grid */
+  bool truncate = true;
 };
 /**
- * Runs the interpreter for a single step over the entire grid.
+ * Runs the interpreter for a single step over a rectangle in the grid.
  */
 void runOneStep(int16_t *oldgrid,
                 int16_t *newgrid,
-                int16_t width,
-                int16_t height,
-                AST::StatementList *ast)
+                Grid::Coordinate width,
+                Grid::Coordinate height,
+                Grid::Coordinate xStart,
+                Grid::Coordinate xEnd,
+                Grid::Coordinate yStart,
+                Grid::Coordinate yEnd,
+                AST::StatementList *ast,
+                Grid::Boundary boundary)
 {
 	Interpreter::State state;
 	state.grid = oldgrid;
 	state.width = width;
 	state.height = height;
-	int i=0;
-	for (int x=0 ; x<width ; x++)
+	state.truncate = (boundary == Grid::Boundary::Truncate);
+	for (Grid::Coordinate x=xStart ; x<xEnd ; x++)
 	{
-		for (int y=0 ; y<height ; y++,i++)
+		Grid::Coordinate i = Grid::index(height, x, yStart);
+		for (Grid::Coordinate y=yStart ; y<yEnd ; y++,i++)
 		{
 			state.v = oldgrid[i];
 			state.x = x;
@@ -165,16 +173,17 @@ uint16_t RangeExpr::interpret(Interpreter::State &s)
 
 uint16_t Neighbours::interpret(Interpreter::State &state)
 {
-	// For each of the (valid) neighbours
-	for (int x = state.x - 1 ; x <= state.x + 1 ; x++)
+	// For each of the (valid) neighbours.  Unless the neighbourhood is
+	// truncated, the halo provides the neighbours of the cells at the edges.
+	for (Grid::Coordinate x = state.x - 1 ; x <= state.x + 1 ; x++)
 	{
-		if (x < 0 || x >= state.width) { continue; }
-		for (int y = state.y - 1 ; y <= state.y + 1 ; y++)
+		if (state.truncate && (x < 0 || x >= state.width)) { continue; }
+		for (Grid::Coordinate y = state.y - 1 ; y <= state.y + 1 ; y++)
 		{
-			if (y < 0 || y >= state.height) { continue; }
+			if (state.truncate && (y < 0 || y >= state.height)) { continue; }
 			if (x == state.x && y == state.y) { continue; }
 			// a0 contains the value for the currently visited neighbour
-			state.a[0] = state.grid[x*state.height + y];
+			state.a[0] = state.grid[Grid::index(state.height, x, y)];
 			// Run all of the statements
 			statements->interpret(state);
 		}
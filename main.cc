@@ -18,64 +18,283 @@
  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#include <algorithm>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <libgen.h>
 #include <time.h>
 #include <unistd.h>
 #include "parser.hh"
 #include "ast.hh"
+#include "bitslice.hh"
+#include "bytecode.hh"
+#include "ensemble.hh"
+#include "gridfile.hh"
+#include "hashlife.hh"
+#include "metrics.hh"
+#include "neighbourhood.hh"
+#include "schedule.hh"
+#include "snapshot.hh"
+#include "threadpool.hh"
+#include "tiles.hh"
 
 static int enableTiming = 0;
 
-static void logTimeSince(clock_t c1, const char *msg)
+// The measurements of each phase of the run.  This writes them out, if
+// requested, when the program exits.
+static Metrics::Recorder metrics;
+
+static void logTimeSince(const Metrics::Sample &c1, const char *msg)
 {
+	const Metrics::Phase &phase = metrics.record(c1, msg);
 	if (!enableTiming) { return; }
-	clock_t c2 = clock();
 	struct rusage r;
 	getrusage(RUSAGE_SELF, &r);
-	fprintf(stderr, "%s took %f seconds.	Peak used %ldKB.\n", msg,
-		(static_cast<double>(c2) - static_cast<double>(c1)) / static_cast<double>(CLOCKS_PER_SEC), r.ru_maxrss);
+	fprintf(stderr, "%s took %f seconds (%f seconds of CPU time).	Peak used %ldKB.\n",
+		msg, phase.wallSeconds, phase.cpuSeconds, r.ru_maxrss);
+}
+
+/**
+ * Returns true if `a` and `b` name the same existing file, even through
+ * different paths or links.
+ */
+static bool sameFile(const std::string &a, const std::string &b)
+{
+	struct stat sa, sb;
+	return (stat(a.c_str(), &sa) == 0) && (stat(b.c_str(), &sb) == 0) &&
+	       (sa.st_dev == sb.st_dev) && (sa.st_ino == sb.st_ino);
+}
+
+/**
+ * Records the parts of a compilation, which are timed by the compiler.
+ */
+static void logCompileTimes(const Compiler::CompileTimes &t)
+{
+	metrics.record("IR generation", t.irGeneration);
+	metrics.record("Optimisation", t.optimisation);
+	metrics.record("Code generation", t.codeGeneration);
+	if (!enableTiming) { return; }
+	fprintf(stderr, "  (IR generation %f, optimisation %f, code generation %f seconds.)\n",
+		t.irGeneration, t.optimisation, t.codeGeneration);
+}
+
+/**
+ * Runs `iterations` generations of a compiled automaton for 8-bit cells on a
+ * grid of 16-bit cells, converting it to and from 8 bits around the run.
+ */
+static void runNarrow(int16_t *grid,
+                      int iterations,
+                      const Schedule &s,
+                      Compiler::narrowAutomaton automaton)
+{
+	size_t cells = Grid::size(s.width, s.height);
+	std::unique_ptr<int8_t[]> n1(new int8_t[cells]());
+	std::unique_ptr<int8_t[]> n2(new int8_t[cells]());
+	std::copy(grid, grid + cells, n1.get());
+	int8_t *o = n1.get();
+	int8_t *n = n2.get();
+	runGenerations(o, n, iterations, s, automaton);
+	std::copy(o, o + cells, grid);
+}
+
+/**
+ * Returns true if interpreting the whole run is likely to take longer than
+ * compiling the program at `optimiseLevel`.  Kernels have no unbounded loops,
+ * so the cost of interpreting a generation can be estimated from the program
+ * alone.
+ */
+static bool worthCompiling(AST::StatementList *ast,
+                           Grid::Coordinate cells,
+                           int iterations,
+                           int threads,
+                           int optimiseLevel)
+{
+	// Roughly how long the bytecode VM takes for each operation and how long
+	// compiling a small program takes.  Most of the compile time is spent in
+	// the optimisation passes, so it grows with the level.
+	const double secondsPerOperation = 1e-9;
+	const double compileSeconds = 0.02 + 0.015 * optimiseLevel;
+	double operations = static_cast<double>(Analysis::operations(ast)) *
+	                    cells * iterations;
+	return operations * secondsPerOperation / threads > compileSeconds;
 }
 
 int main(int argc, char **argv)
 {
 	std::string cmd = argv[0];
 	std::string path = dirname(argv[0]);
+	std::string cacheDirectory;
+	std::string outputFile;
+	std::string gridInput;
+	std::string gridOutput;
+	std::string snapshotFile;
+	std::string metricsFile;
+	std::string profileFile;
+	Compiler::Profile profile;
+	int snapshotInterval = 0;
 	int iterations = 1;
 	bool useJIT = false;
+	bool tiered = false;
+	bool useBytecode = false;
+	bool vectorise = false;
+	bool bitSlice = true;
 	bool debugGrid = false;
+	bool hashLife = false;
+	bool useTable = false;
+	bool narrow = true;
 	int optimiseLevel = 0;
-	int gridSize = 5;
+	Grid::Coordinate gridWidth = 5;
+	Grid::Coordinate gridHeight = 0;
 	int maxValue = 1;
-	clock_t c1;
+	int threads = 1;
+	int tileSize = 32;
+	int blockSize = 0;
+	int generationsPerBlock = 1;
+	int members = 0;
+	Grid::Boundary boundary = Grid::Boundary::Truncate;
+	int16_t edgeValue = 0;
+	Metrics::Sample c1;
 	int c;
 	auto usage = [=]() {
-		std::cerr << "usage: " << cmd << " [-hjt] -i {iterations} -O {level} -x {size} -m {max} {file name}" << std::endl
+		std::cerr << "usage: " << cmd << " [-abhHIjLnStv] -i {iterations} -O {level} -x {width} -y {height} -m {max} -p {threads} -e {edges} -T {size} -B {size} -k {generations} -E {count} -r {grid} -w {grid} -s {generations} -f {file} -M {file} -P {file} -C {directory} -c {output} {file name}" << std::endl
+		          << " -a          Run the bytecode VM while the program is compiled in the background, then switch to the compiled version" << std::endl
+		          << " -b          Interpret the program using the bytecode VM" << std::endl
+		          << " -e {edges}  How to treat neighbours beyond the edges of the grid: truncate, wrap, or a constant value [default: truncate]" << std::endl
 		          << " -h          Display this help" << std::endl
+		          << " -H          Use HashLife to run the program (or the compiled or bytecode version)" << std::endl
+		          << " -I          Count how often each range matches while running the compiled program, and write the counts to the file given with -P" << std::endl
 		          << " -j          Compile (don't interpret) the program" << std::endl
+		          << " -L          Look up each cell's new value in a table of every neighbourhood, if the cells only hold a few values" << std::endl
+		          << " -n          Don't store cells in 8 bits when the compiled program's values fit" << std::endl
+		          << " -S          Don't use the bit-sliced engine for compiled two-state programs" << std::endl
 		          << " -t          Display timing information" << std::endl
+		          << " -v          Explicitly vectorise the compiled program" << std::endl
 		          << " -O {level}  Set the optimisation level [default: " <<optimiseLevel << ']' << std::endl
-		          << " -x {size}   Use a size by size grid [default: " << gridSize << ']' << std::endl
+		          << " -x {width}  Use a grid this many cells wide [default: " << gridWidth << ']' << std::endl
+		          << " -y {height} Use a grid this many cells high [default: the same as the width]" << std::endl
 		          << " -m {max}    The maximum value for a random grid [default: " << maxValue << ']' << std::endl
+		          << " -p {threads} Run on this many threads [default: " << threads << ']' << std::endl
+		          << " -T {size}   Skip size by size tiles that can't change, or 0 to compute every cell [default: " << tileSize << ']' << std::endl
+		          << " -B {size}   Store the grid in size by size blocks, or 0 for one array [default: " << blockSize << ']' << std::endl
+		          << " -r {grid}   Start from the grid in this binary grid file, instead of a random grid" << std::endl
+		          << " -w {grid}   Write the final grid to this binary grid file, instead of printing it" << std::endl
+		          << " -s {generations} Write a snapshot of the grid every this many generations, in the background" << std::endl
+		          << " -f {file}   The file to write snapshots to" << std::endl
+		          << " -M {file}   Write the time and hardware counters for each phase to this file as JSON, or - for the standard error" << std::endl
+		          << " -P {file}   Order the ranges in the compiled program by how often they matched in this profile" << std::endl
+		          << " -C {directory} Keep compiled programs in this directory and reuse them" << std::endl
+		          << " -c {output} Compile the program to an object file (LLVM bitcode if the name ends in .bc, a shared library if it ends in .so) and exit" << std::endl
+		          << " -k {generations} Compute this many generations of each block at a time (uses 64 by 64 blocks unless -B is given) [default: " << generationsPerBlock << ']' << std::endl
+		          << " -E {count}  Run an ensemble of count random grids, computing the same cell in several grids at once when compiled" << std::endl
 		          << " {file name} The .ca source to run" << std::endl;
 	};
-	while ((c = getopt(argc, argv, "dji:tO:x:m:")) != -1)
+	while ((c = getopt(argc, argv, "aB:bC:c:dE:e:f:HIji:k:LM:nP:r:s:StO:T:vw:x:y:m:p:")) != -1)
 	{
 		switch (c)
 		{
 			default:
 				usage();
 				return EXIT_SUCCESS;
+			case 'a':
+				tiered = true;
+				useJIT = true;
+				break;
+			case 'B':
+				blockSize = strtol(optarg, 0, 10);
+				break;
+			case 'b':
+				useBytecode = true;
+				break;
+			case 'C':
+				cacheDirectory = optarg;
+				break;
+			case 'c':
+				outputFile = optarg;
+				break;
+			case 'E':
+				members = strtol(optarg, 0, 10);
+				break;
+			case 'e':
+			{
+				char *end;
+				if (strcmp(optarg, "truncate") == 0)
+				{
+					boundary = Grid::Boundary::Truncate;
+				}
+				else if (strcmp(optarg, "wrap") == 0)
+				{
+					boundary = Grid::Boundary::Wrap;
+				}
+				else
+				{
+					boundary = Grid::Boundary::Constant;
+					long value = strtol(optarg, &end, 10);
+					if (*optarg == '\0' || *end != '\0')
+					{
+						fprintf(stderr, "Edges must be truncate, wrap, or a number\n");
+						return EXIT_FAILURE;
+					}
+					if (value < INT16_MIN || value > INT16_MAX)
+					{
+						fprintf(stderr, "Edge value must be between -2^15 and 2^15-1\n");
+						return EXIT_FAILURE;
+					}
+					edgeValue = value;
+				}
+				break;
+			}
+			case 'f':
+				snapshotFile = optarg;
+				break;
+			case 'H':
+				hashLife = true;
+				break;
+			case 'I':
+				profile.instrument = true;
+				break;
 			case 'j':
 				useJIT = 1;
 				break;
+			case 'L':
+				useTable = true;
+				break;
+			case 'M':
+				metricsFile = optarg;
+				break;
+			case 'n':
+				narrow = false;
+				break;
+			case 'P':
+				profileFile = optarg;
+				break;
+			case 'r':
+				gridInput = optarg;
+				break;
+			case 'v':
+				vectorise = true;
+				break;
+			case 'w':
+				gridOutput = optarg;
+				break;
+			case 's':
+				snapshotInterval = strtol(optarg, 0, 10);
+				break;
+			case 'S':
+				bitSlice = false;
+				break;
 			case 'x':
-				gridSize = strtol(optarg, 0, 10);
+				gridWidth = strtoll(optarg, 0, 10);
+				break;
+			case 'y':
+				gridHeight = strtoll(optarg, 0, 10);
 				break;
 			case 'm':
 				maxValue = strtol(optarg, 0, 10);
@@ -83,6 +302,15 @@ int main(int argc, char **argv)
 			case 'i':
 				iterations = strtol(optarg, 0, 10);
 				break;
+			case 'k':
+				generationsPerBlock = strtol(optarg, 0, 10);
+				break;
+			case 'p':
+				threads = strtol(optarg, 0, 10);
+				break;
+			case 'T':
+				tileSize = strtol(optarg, 0, 10);
+				break;
 			case 't':
 				enableTiming = true;
 				break;
@@ -99,18 +327,121 @@ int main(int argc, char **argv)
 		usage();
 		return EXIT_FAILURE;
 	}
-	if (gridSize < 1 || gridSize >= 1<<15)
+	if (gridHeight == 0)
+	{
+		gridHeight = gridWidth;
+	}
+	// Two grids of 16-bit cells, including their halos, must be addressable.
+	const Grid::Coordinate maxCells = PTRDIFF_MAX / 4;
+	if (gridWidth < 1 || gridHeight < 1 ||
+	    (gridHeight + 2 > maxCells / (gridWidth + 2)))
+	{
+		fprintf(stderr, "Grid width and height must be at least 1, and the grid must fit in memory\n");
+		return EXIT_FAILURE;
+	}
+	if (threads < 1)
+	{
+		fprintf(stderr, "Thread count must be at least 1\n");
+		return EXIT_FAILURE;
+	}
+	if (tileSize < 0 || tileSize >= 1<<15)
 	{
-		fprintf(stderr, "Grid size must be between 1 and 2^15\n");
+		fprintf(stderr, "Tile size must be between 0 and 2^15\n");
 		return EXIT_FAILURE;
 	}
+	// Each block is stored with a ring of its neighbours, which must still
+	// fit in an int16_t.
+	if (blockSize < 0 || blockSize >= 1<<14)
+	{
+		fprintf(stderr, "Block size must be between 0 and 2^14\n");
+		return EXIT_FAILURE;
+	}
+	// Several generations at a time need a ring as deep as the number of
+	// generations around each block.
+	if (generationsPerBlock < 1 || generationsPerBlock >= 1<<12)
+	{
+		fprintf(stderr, "Generations per block must be between 1 and 2^12\n");
+		return EXIT_FAILURE;
+	}
+	if (members < 0)
+	{
+		fprintf(stderr, "Ensemble size must not be negative\n");
+		return EXIT_FAILURE;
+	}
+	// The input is mapped and read as the run goes, so replacing it with
+	// the output (or a snapshot) would corrupt the run.
+	if (!gridInput.empty() &&
+	    ((!gridOutput.empty() && sameFile(gridInput, gridOutput)) ||
+	     (!snapshotFile.empty() && sameFile(gridInput, snapshotFile))))
+	{
+		fprintf(stderr, "The input grid file can't also be written to\n");
+		return EXIT_FAILURE;
+	}
+	if (members > 0 && !gridOutput.empty())
+	{
+		fprintf(stderr, "Ensembles can't be written to a grid file\n");
+		return EXIT_FAILURE;
+	}
+	if (snapshotInterval < 0 || (snapshotInterval > 0 && snapshotFile.empty()))
+	{
+		fprintf(stderr, "Snapshots need a positive interval and a file\n");
+		return EXIT_FAILURE;
+	}
+	if (members > 0 && snapshotInterval > 0)
+	{
+		fprintf(stderr, "Ensembles can't be snapshotted\n");
+		return EXIT_FAILURE;
+	}
+	if (profile.instrument && profileFile.empty())
+	{
+		fprintf(stderr, "Profiling needs a file to write the profile to\n");
+		return EXIT_FAILURE;
+	}
+	if (profile.instrument && members > 0)
+	{
+		fprintf(stderr, "Ensembles can't be profiled\n");
+		return EXIT_FAILURE;
+	}
+	// Only the scalar kernels count matches, so profile those, and the
+	// bit-sliced engine doesn't have ranges to count.
+	if (profile.instrument)
+	{
+		useJIT = true;
+		vectorise = false;
+		bitSlice = false;
+	}
+	// A missing profile is not an error, so that the same command can be used
+	// to collect a profile and then to use it.
+	if (!profileFile.empty() && !profile.load(profileFile) &&
+	    !profile.instrument)
+	{
+		fprintf(stderr, "Ignoring missing or invalid profile %s\n",
+		        profileFile.c_str());
+	}
+	Compiler::Profile *ranges = profileFile.empty() ? nullptr : &profile;
+	if (generationsPerBlock > 1 && blockSize == 0)
+	{
+		blockSize = 64;
+	}
 	argv += optind;
+	// The counters must be opened before any threads are created, so that
+	// they include them.
+	if (!metricsFile.empty())
+	{
+		metrics.openCounters();
+		metrics.setOutput(metricsFile);
+		metrics.addField("program", Metrics::quote(argv[0]));
+		metrics.addField("grid_width", std::to_string(gridWidth));
+		metrics.addField("grid_height", std::to_string(gridHeight));
+		metrics.addField("iterations", std::to_string(iterations));
+		metrics.addField("threads", std::to_string(threads));
+	}
 
 	// Do the parsing
 	Parser::CellAtomParser p;
 	pegmatite::AsciiFileInput input(open(argv[0], O_RDONLY));
 	std::unique_ptr<AST::StatementList> ast = 0;
-	c1 = clock();
+	c1 = metrics.sample();
 	pegmatite::ErrorReporter err =
 		[](const pegmatite::InputRange& r, const std::string& msg) {
 		std::cout << "error: " << msg << std::endl;
@@ -123,66 +454,618 @@ int main(int argc, char **argv)
 	}
 	logTimeSince(c1, "Parsing program");
 	assert(ast);
+	// Programs compiled ahead of time don't know what grid they will run on,
+	// so always use 16-bit cells.
+	if (!outputFile.empty())
+	{
+		c1 = metrics.sample();
+		bool written = Compiler::compileToFile(ast.get(), optimiseLevel,
+		                                       vectorise, boundary, path,
+		                                       outputFile);
+		logTimeSince(c1, "Compiling");
+		logCompileTimes(Compiler::lastCompileTimes());
+		return written ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (hashLife)
+	{
+		// HashLife reuses the results for identical parts of the grid, which
+		// is only valid if each cell depends only on its neighbours.
+		if (Analysis::orderDependent(ast.get()))
+		{
+			fprintf(stderr, "HashLife can't run programs whose global registers depend on the order of the cells\n");
+			return EXIT_FAILURE;
+		}
+		if (boundary == Grid::Boundary::Wrap)
+		{
+			fprintf(stderr, "HashLife can't run with wrapped edges\n");
+			return EXIT_FAILURE;
+		}
+	}
 
-	int16_t oldgrid[] = {
+	int16_t debug[] = {
 		 0,0,0,0,0,
 		 0,0,0,0,0,
 		 0,1,1,1,0,
 		 0,0,0,0,0,
 		 0,0,0,0,0
 	};
-	int16_t newgrid[25];
-	int16_t *g1;
-	int16_t *g2;
 	if (debugGrid)
 	{
-		gridSize = 5;
-		g1 = oldgrid;
-		g2 = newgrid;
+		gridWidth = 5;
+		gridHeight = 5;
 	}
-	else
+	// Grid files use the same layout as the grids in memory, so the input is
+	// used in place and only the pages that are read are loaded.
+	GridFile::MappedGrid input;
+	uint64_t generation = 0;
+	if (!gridInput.empty())
+	{
+		if (!input.open(gridInput.c_str()))
+		{
+			return EXIT_FAILURE;
+		}
+		gridWidth = input.header().width;
+		gridHeight = input.header().height;
+		generation = input.header().generation;
+		debugGrid = false;
+	}
+	// Similarly, the spare grid is the output file, so if the last generation
+	// is computed into it then nothing needs to be copied at the end.
+	GridFile::MappedGrid output;
+	if (!gridOutput.empty() && !output.create(gridOutput.c_str(), gridWidth,
+	                                          gridHeight))
 	{
-		g1 = new int16_t[gridSize * gridSize];
-		g2 = new int16_t[gridSize * gridSize];
-		c1 = clock();
-		for (int i=0 ; i<(gridSize*gridSize) ; i++)
+		return EXIT_FAILURE;
+	}
+	// Both grids have a halo around them (see grid.hh), which is filled in
+	// from the old grid before each generation.
+	int16_t *g1 = gridInput.empty() ?
+		new int16_t[Grid::size(gridWidth, gridHeight)]() : input.cells();
+	int16_t *g2 = gridOutput.empty() ?
+		new int16_t[Grid::size(gridWidth, gridHeight)]() : output.cells();
+	c1 = metrics.sample();
+	for (Grid::Coordinate x=0 ; gridInput.empty() && x<gridWidth ; x++)
+	{
+		for (Grid::Coordinate y=0 ; y<gridHeight ; y++)
 		{
-			g1[i] = random() % (maxValue + 1);
+			g1[Grid::index(gridHeight, x, y)] = debugGrid ?
+				debug[x*gridHeight + y] : random() % (maxValue + 1);
 		}
+	}
+	if (!debugGrid && gridInput.empty())
+	{
 		logTimeSince(c1, "Generating random grid");
 	}
-	int i=0;
-	if (useJIT)
+	// Each thread starts with its own copy of the global registers, which is
+	// only correct if they don't depend on the order of the cells.
+	if (threads > 1 && Analysis::orderDependent(ast.get()))
 	{
-		
-		c1 = clock();
-		Compiler::automaton ca = Compiler::compile(ast.get(), optimiseLevel, path);
-		logTimeSince(c1, "Compiling");
-		c1 = clock();
-		for (int i=0 ; i<iterations ; i++)
+		std::cerr << "Warning: running a kernel whose global registers depend on the order of the cells on one thread" << std::endl;
+		threads = 1;
+	}
+	// The pool is created once and reused for every generation.
+	ThreadPool pool(threads);
+	// Every member of an ensemble is run with the same program.  The first
+	// member has the grid that a single run would have, and the others get
+	// grids of their own.  Compiled programs run all of the members together,
+	// and the interpreter and bytecode VM run each in turn.  Neither uses
+	// tiles, blocks, HashLife, or the bit-sliced or 8-bit layouts.
+	if (members > 0)
+	{
+		std::vector<int16_t*> grids(1, g1);
+		for (int m=1 ; m<members ; m++)
+		{
+			int16_t *grid = new int16_t[Grid::size(gridWidth, gridHeight)]();
+			for (Grid::Coordinate x=0 ; x<gridWidth ; x++)
+			{
+				for (Grid::Coordinate y=0 ; y<gridHeight ; y++)
+				{
+					grid[Grid::index(gridHeight, x, y)] = debugGrid ?
+						debug[x*gridHeight + y] : random() % (maxValue + 1);
+				}
+			}
+			grids.push_back(grid);
+		}
+		if (useJIT)
+		{
+			c1 = metrics.sample();
+			std::unique_ptr<Compiler::Code> code;
+			Compiler::ensembleAutomaton ca =
+				Compiler::compileEnsemble(ast.get(), optimiseLevel, boundary,
+				                          path, cacheDirectory, code);
+			if (!ca)
+			{
+				std::cerr << Compiler::lastError() << std::endl;
+				return EXIT_FAILURE;
+			}
+			logTimeSince(c1, "Compiling");
+			logCompileTimes(Compiler::lastCompileTimes());
+			c1 = metrics.sample();
+			Ensemble ensemble(gridWidth, gridHeight, members, boundary,
+			                  edgeValue);
+			for (int m=0 ; m<members ; m++)
+			{
+				ensemble.load(m, grids[m]);
+			}
+			for (int i=0 ; i<iterations ; i++)
+			{
+				ensemble.step(pool, ca);
+			}
+			for (int m=0 ; m<members ; m++)
+			{
+				ensemble.store(m, grids[m]);
+			}
+			logTimeSince(c1, "Running compiled ensemble");
+		}
+		else
 		{
-			ca(g1, g2, gridSize, gridSize);
-			std::swap(g1, g2);
+			c1 = metrics.sample();
+			Schedule schedule = { gridWidth, gridHeight, boundary, edgeValue,
+			                      0, 1, nullptr, &pool, nullptr };
+			Bytecode::Program program;
+			if (useBytecode)
+			{
+				program = Bytecode::compile(ast.get(), boundary);
+				if (!program.error.empty())
+				{
+					std::cerr << program.error << std::endl;
+					return EXIT_FAILURE;
+				}
+			}
+			for (int m=0 ; m<members ; m++)
+			{
+				runGenerations(grids[m], g2, iterations, schedule,
+				               [&](int16_t *o, int16_t *n,
+				                   Grid::Coordinate w, Grid::Coordinate h,
+				                   Grid::Coordinate xStart, Grid::Coordinate xEnd,
+				                   Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+					if (useBytecode)
+					{
+						Bytecode::runOneStep(o, n, w, h, xStart, xEnd, yStart,
+						                     yEnd, program);
+					}
+					else
+					{
+						Interpreter::runOneStep(o, n, w, h, xStart, xEnd,
+						                        yStart, yEnd, ast.get(),
+						                        boundary);
+					}
+				});
+			}
+			logTimeSince(c1, "Running ensemble");
 		}
-		logTimeSince(c1, "Running compiled version");
+		c1 = metrics.sample();
+		for (int m=0 ; m<members ; m++)
+		{
+			if (m > 0)
+			{
+				putchar('\n');
+			}
+			for (Grid::Coordinate x=0 ; x<gridWidth ; x++)
+			{
+				for (Grid::Coordinate y=0 ; y<gridHeight ; y++)
+				{
+					printf("%d ", grids[m][Grid::index(gridHeight, x, y)]);
+				}
+				putchar('\n');
+			}
+		}
+		fflush(stdout);
+		logTimeSince(c1, "Printing grid");
+		return 0;
 	}
-	else
+	// Skipping tiles relies on each cell depending only on its neighbours,
+	// which isn't true if the kernel's global registers depend on the order
+	// of the cells.  Neither is computing each block separately.  Blocks are
+	// always computed, so tiles aren't used with them.
+	bool orderDependent = Analysis::orderDependent(ast.get());
+	if (blockSize > 0 && orderDependent)
+	{
+		std::cerr << "Warning: not using blocks for a kernel whose global registers depend on the order of the cells" << std::endl;
+		if (generationsPerBlock > 1)
+		{
+			std::cerr << "Warning: computing one generation at a time, ignoring -k" << std::endl;
+		}
+		blockSize = 0;
+		generationsPerBlock = 1;
+	}
+	std::unique_ptr<ActiveTiles> tiles;
+	if (tileSize > 0 && blockSize == 0 && !orderDependent)
+	{
+		tiles.reset(new ActiveTiles(gridWidth, gridHeight, tileSize, boundary));
+	}
+	// Snapshots are written on another thread, with a few frames in flight so
+	// that a slow write doesn't hold up the run at once.
+	const int snapshotBuffers = 4;
+	std::unique_ptr<SnapshotWriter> snapshots;
+	if (snapshotInterval > 0)
 	{
-		c1 = clock();
+		FILE *f = fopen(snapshotFile.c_str(), "wb");
+		if (!f)
+		{
+			perror(snapshotFile.c_str());
+			return EXIT_FAILURE;
+		}
+		snapshots.reset(new SnapshotWriter(f, gridWidth, gridHeight,
+		                                   snapshotInterval, snapshotBuffers,
+		                                   generation));
+	}
+	Schedule schedule = { gridWidth, gridHeight, boundary, edgeValue,
+	                      static_cast<int16_t>(blockSize),
+	                      static_cast<int16_t>(generationsPerBlock),
+	                      tiles.get(), &pool, snapshots.get() };
+	// HashLife runs the engine on small pieces of the grid, one step at a
+	// time, and memoises the results.
+	auto runHashLife = [&](HashLife::Universe::Step step) {
+		c1 = metrics.sample();
+		HashLife::Universe universe(step, boundary, edgeValue);
+		universe.load(g1, gridWidth, gridHeight);
+		// The grid is only copied out of the tree when a snapshot is due.
+		for (int done=0 ; done<iterations ; )
+		{
+			int generations = iterations - done;
+			if (snapshots)
+			{
+				generations = std::min(generations, snapshots->untilNext());
+			}
+			universe.run(generations);
+			done += generations;
+			if (snapshots && snapshots->advance(generations))
+			{
+				universe.store(g1);
+				snapshots->take(g1);
+			}
+		}
+		universe.store(g1);
+		logTimeSince(c1, "Running HashLife");
+	};
+	// Finds the range of the values that the cells start with, including
+	// the edges.  The halo is still empty, so contains only zeroes.
+	auto initialValues = [&](int16_t &min, int16_t &max) {
+		auto range = std::minmax_element(g1, g1 + Grid::size(gridWidth, gridHeight));
+		min = *range.first;
+		max = *range.second;
+		if (boundary == Grid::Boundary::Constant)
+		{
+			min = std::min(min, edgeValue);
+			max = std::max(max, edgeValue);
+		}
+	};
+	// If the cells only ever hold a few values, then the new value for every
+	// possible neighbourhood can be computed in advance.
+	Neighbourhood::Table table;
+	useTable = useTable && !hashLife;
+	if (useTable)
+	{
+		c1 = metrics.sample();
+		int16_t min, max;
+		initialValues(min, max);
+		useTable = (min >= 0) &&
+		           Neighbourhood::build(ast.get(), max, boundary, table);
+		logTimeSince(c1, "Building the neighbourhood table");
+		if (!useTable)
+		{
+			std::cerr << "Warning: not using a neighbourhood table for a kernel whose global registers depend on the order of the cells, or that has too many values" << std::endl;
+		}
+	}
+	// If the program is a two-state rule, and the grid only contains zeroes
+	// and ones, then the compiler can use one bit per cell.
+	BitSlice::Rule rule;
+	bitSlice = bitSlice && !useTable;
+	if (useJIT && bitSlice && !hashLife)
+	{
+		c1 = metrics.sample();
+		bitSlice = BitSlice::analyse(ast.get(), boundary, edgeValue, rule) &&
+		           BitSlice::isTwoState(g1, gridWidth, gridHeight);
+		logTimeSince(c1, "Checking for a two-state program");
+	}
+	// Otherwise, if every value that the program can compute fits in 7 bits,
+	// then the compiled version can store each cell in a byte, which halves
+	// the memory traffic and doubles the number of cells in each vector.
+	narrow = narrow && useJIT && !hashLife && !bitSlice && !useTable;
+	if (narrow)
+	{
+		c1 = metrics.sample();
+		int16_t min, max;
+		initialValues(min, max);
+		narrow = (min >= 0) && Analysis::valuesFit(ast.get(), max, INT8_MAX);
+		logTimeSince(c1, "Checking whether values fit in 8 bits");
+	}
+	// The bytecode VM, like the interpreter, treats values as unsigned, but
+	// compiled code treats them as signed, so the two only agree while every
+	// value is in [0, INT16_MAX].  A tiered run only switches from one to the
+	// other if no value can leave that range (which is always true if the
+	// values fit in 8 bits).  Otherwise, the whole run uses one engine: the
+	// compiled version if compiling pays off, and the bytecode VM if not.
+	if (tiered && !hashLife && !bitSlice && !useTable && !narrow)
+	{
+		c1 = metrics.sample();
+		int16_t min, max;
+		initialValues(min, max);
+		if ((min < 0) || !Analysis::valuesFit(ast.get(), max, INT16_MAX))
+		{
+			std::cerr << "Warning: not switching engines during a run whose values may be negative" << std::endl;
+			tiered = false;
+			useJIT = worthCompiling(ast.get(), gridWidth * gridHeight,
+			                        iterations, threads, optimiseLevel);
+			useBytecode = !useJIT;
+		}
+		logTimeSince(c1, "Checking whether values are non-negative");
+	}
+	if (useTable)
+	{
+		c1 = metrics.sample();
+		runGenerations(g1, g2, iterations, schedule,
+		               [&](int16_t *o, int16_t *n,
+		                   Grid::Coordinate w, Grid::Coordinate h,
+		                   Grid::Coordinate xStart, Grid::Coordinate xEnd,
+		                   Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+			Neighbourhood::runOneStep(o, n, w, h, xStart, xEnd, yStart, yEnd,
+			                          table);
+		});
+		logTimeSince(c1, "Running neighbourhood table");
+	}
+	else if (useJIT && bitSlice && !hashLife)
+	{
+		c1 = metrics.sample();
+		BitSlice::BitGrid grid(gridWidth, gridHeight, boundary, edgeValue);
+		grid.load(g1);
 		for (int i=0 ; i<iterations ; i++)
 		{
-			Interpreter::runOneStep(g1, g2, gridSize, gridSize, ast.get());
-			std::swap(g1, g2);
+			grid.step(rule, pool);
+			if (snapshots && snapshots->advance(1))
+			{
+				grid.store(g1);
+				snapshots->take(g1);
+			}
+		}
+		grid.store(g1);
+		logTimeSince(c1, "Running bit-sliced version");
+	}
+	else if (tiered && !hashLife)
+	{
+		// Start running the bytecode VM at once and compile the program in
+		// the background, unless the run is too short for that to pay off.
+		c1 = metrics.sample();
+		Bytecode::Program program = Bytecode::compile(ast.get(), boundary);
+		if (!program.error.empty())
+		{
+			std::cerr << program.error << std::endl;
+			return EXIT_FAILURE;
+		}
+		logTimeSince(c1, "Compiling to bytecode");
+		Compiler::automaton ca = nullptr;
+		Compiler::narrowAutomaton na = nullptr;
+		std::unique_ptr<Compiler::Code> code;
+		// The compiler records its times and errors on the thread that runs
+		// it.  Everything that the task writes must outlive the future,
+		// whose destructor waits for the task if the bytecode VM finishes
+		// first.
+		Compiler::CompileTimes compileTimes;
+		std::string compileError;
+		std::future<void> compiling;
+		if (worthCompiling(ast.get(), gridWidth * gridHeight, iterations,
+		                   threads, optimiseLevel))
+		{
+			compiling = std::async(std::launch::async, [&]() {
+				if (narrow)
+				{
+					na = Compiler::compileNarrow(ast.get(), optimiseLevel,
+					                             vectorise, boundary, path,
+					                             cacheDirectory, code, ranges);
+				}
+				else
+				{
+					ca = Compiler::compile(ast.get(), optimiseLevel, vectorise,
+					                       boundary, path, cacheDirectory,
+					                       code, ranges);
+				}
+				compileTimes = Compiler::lastCompileTimes();
+				compileError = Compiler::lastError();
+			});
+		}
+		auto compiled = [&]() {
+			return compiling.valid() &&
+			       (compiling.wait_for(std::chrono::seconds(0)) ==
+			        std::future_status::ready);
+		};
+		// Switch at the end of the first generation after the compiled
+		// version is ready.  Blocked grids compute several generations in
+		// each call, so can only switch between calls.
+		int done = 0;
+		c1 = metrics.sample();
+		while ((done < iterations) && !compiled())
+		{
+			int generations = std::min(iterations - done,
+			                           blockSize > 0 ? generationsPerBlock : 1);
+			runGenerations(g1, g2, generations, schedule,
+			               [&](int16_t *o, int16_t *n,
+			                   Grid::Coordinate w, Grid::Coordinate h,
+			                   Grid::Coordinate xStart, Grid::Coordinate xEnd,
+			                   Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+				Bytecode::runOneStep(o, n, w, h, xStart, xEnd, yStart, yEnd,
+				                     program);
+			});
+			done += generations;
+		}
+		logTimeSince(c1, "Running bytecode");
+		if (done < iterations)
+		{
+			compiling.get();
+			if (!compileError.empty())
+			{
+				std::cerr << compileError << std::endl;
+				return EXIT_FAILURE;
+			}
+			logCompileTimes(compileTimes);
+			c1 = metrics.sample();
+			if (narrow)
+			{
+				runNarrow(g1, iterations - done, schedule, na);
+			}
+			else
+			{
+				runGenerations(g1, g2, iterations - done, schedule, ca);
+			}
+			logTimeSince(c1, "Running compiled version");
+		}
+		else if (compiling.valid())
+		{
+			// The compiler can't be interrupted, and the code that it is
+			// using is destroyed when this returns, so wait for it.  This
+			// is recorded separately, so that it isn't mistaken for time
+			// spent running the program.
+			c1 = metrics.sample();
+			compiling.wait();
+			logTimeSince(c1, "Waiting for the unused compile");
+		}
+	}
+	else if (narrow)
+	{
+		c1 = metrics.sample();
+		std::unique_ptr<Compiler::Code> code;
+		Compiler::narrowAutomaton ca =
+			Compiler::compileNarrow(ast.get(), optimiseLevel, vectorise,
+			                        boundary, path, cacheDirectory, code,
+			                        ranges);
+		if (!ca)
+		{
+			std::cerr << Compiler::lastError() << std::endl;
+			return EXIT_FAILURE;
 		}
+		logTimeSince(c1, "Compiling");
+		logCompileTimes(Compiler::lastCompileTimes());
+		c1 = metrics.sample();
+		runNarrow(g1, iterations, schedule, ca);
+		logTimeSince(c1, "Running compiled 8-bit version");
+	}
+	else if (useJIT)
+	{
+		c1 = metrics.sample();
+		std::unique_ptr<Compiler::Code> code;
+		Compiler::automaton ca = Compiler::compile(ast.get(), optimiseLevel,
+		                                           vectorise, boundary, path,
+		                                           cacheDirectory, code,
+		                                           ranges);
+		if (!ca)
+		{
+			std::cerr << Compiler::lastError() << std::endl;
+			return EXIT_FAILURE;
+		}
+		logTimeSince(c1, "Compiling");
+		logCompileTimes(Compiler::lastCompileTimes());
+		if (hashLife)
+		{
+			runHashLife([&](int16_t *o, int16_t *n,
+			                Grid::Coordinate w, Grid::Coordinate h) {
+				ca(o, n, w, h, 0, w, 0, h);
+			});
+		}
+		else
+		{
+			c1 = metrics.sample();
+			runGenerations(g1, g2, iterations, schedule, ca);
+			logTimeSince(c1, "Running compiled version");
+		}
+	}
+	else if (useBytecode)
+	{
+		c1 = metrics.sample();
+		Bytecode::Program program = Bytecode::compile(ast.get(), boundary);
+		if (!program.error.empty())
+		{
+			std::cerr << program.error << std::endl;
+			return EXIT_FAILURE;
+		}
+		logTimeSince(c1, "Compiling to bytecode");
+		if (hashLife)
+		{
+			runHashLife([&](int16_t *o, int16_t *n,
+			                Grid::Coordinate w, Grid::Coordinate h) {
+				Bytecode::runOneStep(o, n, w, h, 0, w, 0, h, program);
+			});
+		}
+		else
+		{
+			c1 = metrics.sample();
+			runGenerations(g1, g2, iterations, schedule,
+			               [&](int16_t *o, int16_t *n,
+			                   Grid::Coordinate w, Grid::Coordinate h,
+			                   Grid::Coordinate xStart, Grid::Coordinate xEnd,
+			                   Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+				Bytecode::runOneStep(o, n, w, h, xStart, xEnd, yStart, yEnd,
+				                     program);
+			});
+			logTimeSince(c1, "Running bytecode");
+		}
+	}
+	else if (hashLife)
+	{
+		runHashLife([&](int16_t *o, int16_t *n,
+		                Grid::Coordinate w, Grid::Coordinate h) {
+			Interpreter::runOneStep(o, n, w, h, 0, w, 0, h, ast.get(),
+			                        boundary);
+		});
+	}
+	else
+	{
+		c1 = metrics.sample();
+		runGenerations(g1, g2, iterations, schedule,
+		               [&](int16_t *o, int16_t *n,
+		                   Grid::Coordinate w, Grid::Coordinate h,
+		                   Grid::Coordinate xStart, Grid::Coordinate xEnd,
+		                   Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+			Interpreter::runOneStep(o, n, w, h, xStart, xEnd, yStart, yEnd,
+			                        ast.get(), boundary);
+		});
 		logTimeSince(c1, "Interpreting");
 	}
-	for (int x=0 ; x<gridSize ; x++)
+	if (profile.instrument && !profile.save(profileFile))
+	{
+		return EXIT_FAILURE;
+	}
+	if (snapshots)
+	{
+		// Wait for the last snapshots to be written.
+		c1 = metrics.sample();
+		int taken = snapshots->taken();
+		double stalled = snapshots->stalledSeconds();
+		if (!snapshots->finish())
+		{
+			fprintf(stderr, "Failed to write snapshots to %s: %s\n",
+			        snapshotFile.c_str(), strerror(snapshots->error()));
+			return EXIT_FAILURE;
+		}
+		snapshots.reset();
+		logTimeSince(c1, "Finishing snapshots");
+		if (enableTiming)
+		{
+			fprintf(stderr, "Waited %f seconds for the writer while taking %d snapshots.\n",
+			        stalled, taken);
+		}
+	}
+	if (!gridOutput.empty())
+	{
+		c1 = metrics.sample();
+		size_t cells = Grid::size(gridWidth, gridHeight);
+		if (g1 != output.cells())
+		{
+			std::copy(g1, g1 + cells, output.cells());
+		}
+		output.header().generation = generation + iterations;
+		logTimeSince(c1, "Writing grid");
+		return 0;
+	}
+	c1 = metrics.sample();
+	for (Grid::Coordinate x=0 ; x<gridWidth ; x++)
 	{
-		for (int y=0 ; y<gridSize ; y++)
+		for (Grid::Coordinate y=0 ; y<gridHeight ; y++)
 		{
-			printf("%d ", g1[i++]);
+			printf("%d ", g1[Grid::index(gridHeight, x, y)]);
 		}
 		putchar('\n');
 	}
+	fflush(stdout);
+	logTimeSince(c1, "Printing grid");
 	return 0;
 }
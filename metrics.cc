@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "metrics.hh"
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Metrics
+{
+
+/** The names of the counters in the record */
+static const char *counterNames[CounterCount] = {
+	"cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+#ifdef __linux__
+/**
+ * Opens a counter for this process and any threads that it creates later.
+ * Returns -1 if the counter isn't available.
+ */
+static int openCounter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.inherit = 1;
+	// Unprivileged processes are often only allowed to count user-space
+	// events, and the kernel's share isn't interesting here anyway.
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+std::string quote(const std::string &str)
+{
+	std::string json = "\"";
+	for (char c : str)
+	{
+		if ((c == '"') || (c == '\\'))
+		{
+			json += '\\';
+			json += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			json += escape;
+		}
+		else
+		{
+			json += c;
+		}
+	}
+	return json + "\"";
+}
+
+Recorder::Recorder()
+{
+	for (int &fd : fds)
+	{
+		fd = -1;
+	}
+}
+
+Recorder::~Recorder()
+{
+	if (!output.empty())
+	{
+		write(output);
+	}
+	for (int fd : fds)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+}
+
+void Recorder::openCounters()
+{
+#ifdef __linux__
+	fds[Cycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	fds[Instructions] = openCounter(PERF_TYPE_HARDWARE,
+	                                PERF_COUNT_HW_INSTRUCTIONS);
+	fds[CacheMisses] = openCounter(PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	fds[BranchMisses] = openCounter(PERF_TYPE_HARDWARE,
+	                                PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+}
+
+Sample Recorder::sample() const
+{
+	Sample s;
+	for (int i=0 ; i<CounterCount ; i++)
+	{
+		s.counters[i] = 0;
+		if ((fds[i] >= 0) &&
+		    (read(fds[i], &s.counters[i], sizeof(uint64_t)) != sizeof(uint64_t)))
+		{
+			s.counters[i] = 0;
+		}
+	}
+	s.cpu = clock();
+	s.wall = std::chrono::steady_clock::now();
+	return s;
+}
+
+const Phase &Recorder::record(const Sample &start, const std::string &name)
+{
+	Sample end = sample();
+	Phase p;
+	p.name = name;
+	std::chrono::duration<double> wall = end.wall - start.wall;
+	p.wallSeconds = wall.count();
+	p.cpuSeconds = (static_cast<double>(end.cpu) -
+	                static_cast<double>(start.cpu)) / CLOCKS_PER_SEC;
+	p.counted = true;
+	for (int i=0 ; i<CounterCount ; i++)
+	{
+		p.counters[i] = end.counters[i] - start.counters[i];
+	}
+	phases.push_back(p);
+	return phases.back();
+}
+
+void Recorder::record(const std::string &name, double wallSeconds)
+{
+	Phase p;
+	p.name = name;
+	p.wallSeconds = wallSeconds;
+	p.cpuSeconds = -1;
+	p.counted = false;
+	phases.push_back(p);
+}
+
+void Recorder::addField(const std::string &name, const std::string &json)
+{
+	fields.push_back(std::make_pair(name, json));
+}
+
+bool Recorder::write(const std::string &file) const
+{
+	FILE *out = (file == "-") ? stderr : fopen(file.c_str(), "w");
+	if (!out)
+	{
+		perror(file.c_str());
+		return false;
+	}
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+	fprintf(out, "{");
+	for (auto &f : fields)
+	{
+		fprintf(out, "\"%s\": %s, ", f.first.c_str(), f.second.c_str());
+	}
+	fprintf(out, "\"peak_rss_kb\": %ld, \"counters\": {", r.ru_maxrss);
+	for (int i=0 ; i<CounterCount ; i++)
+	{
+		fprintf(out, "%s\"%s\": %s", i ? ", " : "", counterNames[i],
+		        (fds[i] >= 0) ? "true" : "false");
+	}
+	fprintf(out, "}, \"phases\": [");
+	for (size_t i=0 ; i<phases.size() ; i++)
+	{
+		const Phase &p = phases[i];
+		fprintf(out, "%s{\"name\": %s, \"wall_seconds\": %g",
+		        i ? ", " : "", quote(p.name).c_str(), p.wallSeconds);
+		if (p.cpuSeconds >= 0)
+		{
+			fprintf(out, ", \"cpu_seconds\": %g", p.cpuSeconds);
+		}
+		for (int c=0 ; c<CounterCount ; c++)
+		{
+			if (p.counted && (fds[c] >= 0))
+			{
+				fprintf(out, ", \"%s\": %llu", counterNames[c],
+				        static_cast<unsigned long long>(p.counters[c]));
+			}
+		}
+		fprintf(out, "}");
+	}
+	fprintf(out, "]}\n");
+	if (out != stderr)
+	{
+		fclose(out);
+	}
+	return true;
+}
+
+} // namespace Metrics
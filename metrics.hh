@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_METRICS_H_INCLUDED
+#define CELLATOM_METRICS_H_INCLUDED
+#include <chrono>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+/**
+ * Measurements of each phase of a run.  Phases are timed with the wall clock,
+ * which, unlike the CPU time, is still meaningful when several threads are
+ * running, and with hardware performance counters where the system provides
+ * them.  The counters include every thread created after they are opened.
+ */
+namespace Metrics
+{
+	/**
+	 * The hardware events that are counted.
+	 */
+	enum Counter
+	{
+		Cycles,
+		Instructions,
+		/** Reads that missed in the last-level cache */
+		CacheMisses,
+		BranchMisses,
+		CounterCount
+	};
+
+	/**
+	 * A reading of every clock and counter at one point in time.
+	 */
+	struct Sample
+	{
+		/** The wall-clock time */
+		std::chrono::steady_clock::time_point wall;
+		/** The CPU time used by the process */
+		clock_t cpu;
+		/** The value of each counter, or zero for those that aren't open */
+		uint64_t counters[CounterCount];
+	};
+
+	/**
+	 * The measurements for one phase.
+	 */
+	struct Phase
+	{
+		/** The name of the phase */
+		std::string name;
+		/** The wall-clock time taken */
+		double wallSeconds;
+		/** The CPU time taken, or a negative value if not measured */
+		double cpuSeconds;
+		/** Whether the counters were measured for this phase */
+		bool counted;
+		/** The number of each event during the phase */
+		uint64_t counters[CounterCount];
+	};
+
+	/**
+	 * Returns a string as a JSON string literal, including the quotes.
+	 */
+	std::string quote(const std::string &str);
+
+	/**
+	 * Records the phases of a run and writes them out as JSON.
+	 */
+	class Recorder
+	{
+		public:
+		Recorder();
+		/**
+		 * Destroys the recorder, writing the record first if an output file
+		 * has been set.
+		 */
+		~Recorder();
+		/**
+		 * Opens the hardware counters.  Counters that the system doesn't
+		 * support, or that this process isn't allowed to use, are left out.
+		 */
+		void openCounters();
+		/**
+		 * Reads the clocks and counters.
+		 */
+		Sample sample() const;
+		/**
+		 * Records a phase that started at `start` and ends now, and returns
+		 * it.
+		 */
+		const Phase &record(const Sample &start, const std::string &name);
+		/**
+		 * Records a phase that was timed elsewhere, with only its wall-clock
+		 * time.
+		 */
+		void record(const std::string &name, double wallSeconds);
+		/**
+		 * Adds a field, which must be valid JSON, to the top level of the
+		 * record.
+		 */
+		void addField(const std::string &name, const std::string &json);
+		/**
+		 * Sets the file that the record is written to when the recorder is
+		 * destroyed, or `-` for the standard error.
+		 */
+		void setOutput(const std::string &file)
+		{
+			output = file;
+		}
+		/**
+		 * Writes the record, as a single JSON object, to a file (or `-` for
+		 * the standard error).  Returns false if the file can't be opened.
+		 */
+		bool write(const std::string &file) const;
+		private:
+		/** The file descriptor for each counter, or -1 if it isn't open */
+		int fds[CounterCount];
+		/** The phases, in the order that they ended */
+		std::vector<Phase> phases;
+		/** The extra fields, as name and JSON value pairs */
+		std::vector<std::pair<std::string, std::string>> fields;
+		/** The file to write the record to, if any */
+		std::string output;
+	};
+}
+
+#endif // CELLATOM_METRICS_H_INCLUDED
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "neighbourhood.hh"
+#include "ast.hh"
+#include <algorithm>
+
+namespace Neighbourhood
+{
+
+namespace
+{
+/**
+ * Sets the cells of a 3x3 grid to the neighbourhood with the specified index
+ * in a table for cells with `states` values.
+ */
+void setNeighbourhood(int16_t *grid, size_t index, int states)
+{
+	// The last digit is the cell at (x+1, y+1), as in `Table`.
+	for (int dy=1 ; dy>=-1 ; dy--)
+	{
+		for (int dx=1 ; dx>=-1 ; dx--)
+		{
+			grid[Grid::index(3, 1+dx, 1+dy)] = index % states;
+			index /= states;
+		}
+	}
+}
+
+/**
+ * Runs the table for every neighbourhood for the cells with x in [xStart,
+ * xEnd) and y in [yStart, yEnd), all of which must have all eight neighbours.
+ * The index is kept from one cell to the next along each column, adding the
+ * three cells that come into the neighbourhood and dropping the three that
+ * leave it.  The number of states is a template parameter so that the
+ * arithmetic on the index uses constants.
+ */
+template<int States>
+void runNeighbourhoods(int16_t *oldgrid,
+                       int16_t *newgrid,
+                       Grid::Coordinate height,
+                       Grid::Coordinate xStart,
+                       Grid::Coordinate xEnd,
+                       Grid::Coordinate yStart,
+                       Grid::Coordinate yEnd,
+                       const uint8_t *entries)
+{
+	const unsigned rowValues = States * States * States;
+	const unsigned twoRowValues = rowValues * rowValues;
+	for (Grid::Coordinate x=xStart ; x<xEnd ; x++)
+	{
+		const int16_t *left = oldgrid + Grid::index(height, x-1, 0);
+		const int16_t *centre = oldgrid + Grid::index(height, x, 0);
+		const int16_t *right = oldgrid + Grid::index(height, x+1, 0);
+		int16_t *out = newgrid + Grid::index(height, x, 0);
+		auto row = [&](Grid::Coordinate y)
+		{
+			return (unsigned(left[y]) * States + unsigned(centre[y])) * States +
+			       unsigned(right[y]);
+		};
+		unsigned index = row(yStart-1) * rowValues + row(yStart);
+		for (Grid::Coordinate y=yStart ; y<yEnd ; y++)
+		{
+			index = (index % twoRowValues) * rowValues + row(y+1);
+			out[y] = entries[index];
+		}
+	}
+}
+
+/**
+ * Runs a totalistic table over the cells with x in [xStart, xEnd) and y in
+ * [yStart, yEnd), all of which must have all eight neighbours.  The sums of
+ * the three cells at each y are kept from one cell to the next along each
+ * column, so each cell only needs one new sum.
+ */
+template<int States>
+void runTotalistic(int16_t *oldgrid,
+                   int16_t *newgrid,
+                   Grid::Coordinate height,
+                   Grid::Coordinate xStart,
+                   Grid::Coordinate xEnd,
+                   Grid::Coordinate yStart,
+                   Grid::Coordinate yEnd,
+                   const uint8_t *entries)
+{
+	const int sums = 8 * (States - 1) + 1;
+	for (Grid::Coordinate x=xStart ; x<xEnd ; x++)
+	{
+		const int16_t *left = oldgrid + Grid::index(height, x-1, 0);
+		const int16_t *centre = oldgrid + Grid::index(height, x, 0);
+		const int16_t *right = oldgrid + Grid::index(height, x+1, 0);
+		int16_t *out = newgrid + Grid::index(height, x, 0);
+		auto column = [&](Grid::Coordinate y)
+		{
+			return left[y] + centre[y] + right[y];
+		};
+		int before = column(yStart-1);
+		int here = column(yStart);
+		for (Grid::Coordinate y=yStart ; y<yEnd ; y++)
+		{
+			int after = column(y+1);
+			int v = centre[y];
+			out[y] = entries[v * sums + before + here + after - v];
+			before = here;
+			here = after;
+		}
+	}
+}
+
+/**
+ * Runs either kind of table over cells that all have eight neighbours.
+ */
+template<int States>
+void runTable(int16_t *oldgrid,
+              int16_t *newgrid,
+              Grid::Coordinate height,
+              Grid::Coordinate xStart,
+              Grid::Coordinate xEnd,
+              Grid::Coordinate yStart,
+              Grid::Coordinate yEnd,
+              const Table &table)
+{
+	if (table.totalistic)
+	{
+		runTotalistic<States>(oldgrid, newgrid, height, xStart, xEnd, yStart,
+		                      yEnd, table.entries.data());
+	}
+	else
+	{
+		runNeighbourhoods<States>(oldgrid, newgrid, height, xStart, xEnd,
+		                          yStart, yEnd, table.entries.data());
+	}
+}
+}
+
+bool build(AST::StatementList *ast,
+           int16_t initial,
+           Grid::Boundary boundary,
+           Table &table)
+{
+	// The result must depend only on the neighbourhood.
+	if (Analysis::orderDependent(ast) || (initial < 0))
+	{
+		return false;
+	}
+	// The centre of a 3x3 grid has every neighbour, whatever the boundary.
+	Bytecode::Program program = Bytecode::compile(ast,
+	                                              Grid::Boundary::Truncate);
+	if (!program.error.empty())
+	{
+		return false;
+	}
+	int16_t oldgrid[(3+2)*(3+2)] = {0};
+	int16_t newgrid[(3+2)*(3+2)] = {0};
+	// Start with the values that the cells start with, and add any new
+	// values that the kernel computes from them until there are no more.
+	int states = initial + 1;
+	for (;;)
+	{
+		size_t count = 1;
+		for (int i=0 ; i<9 ; i++)
+		{
+			count *= states;
+			if (count > MaxEntries)
+			{
+				return false;
+			}
+		}
+		table.entries.resize(count);
+		int largest = 0;
+		for (size_t i=0 ; i<count ; i++)
+		{
+			setNeighbourhood(oldgrid, i, states);
+			Bytecode::runOneStep(oldgrid, newgrid, 3, 3, 1, 2, 1, 2, program);
+			int16_t result = newgrid[Grid::index(3, 1, 1)];
+			if (result < 0)
+			{
+				return false;
+			}
+			largest = std::max<int>(largest, result);
+			table.entries[i] = std::min<int>(result, UINT8_MAX);
+		}
+		if (largest < states)
+		{
+			break;
+		}
+		states = largest + 1;
+	}
+	table.states = states;
+	// If the result only depends on the value of the cell and the sum of its
+	// neighbours, then a much smaller table is enough.
+	int sums = 8 * (states - 1) + 1;
+	std::vector<int> totals(states * sums, -1);
+	table.totalistic = true;
+	for (size_t i=0 ; i<table.entries.size() ; i++)
+	{
+		setNeighbourhood(oldgrid, i, states);
+		int v = oldgrid[Grid::index(3, 1, 1)];
+		int sum = -v;
+		for (int x=0 ; x<3 ; x++)
+		{
+			for (int y=0 ; y<3 ; y++)
+			{
+				sum += oldgrid[Grid::index(3, x, y)];
+			}
+		}
+		int &total = totals[v * sums + sum];
+		if ((total != -1) && (total != table.entries[i]))
+		{
+			table.totalistic = false;
+			break;
+		}
+		total = table.entries[i];
+	}
+	if (table.totalistic)
+	{
+		table.entries.assign(totals.begin(), totals.end());
+	}
+	table.truncate = (boundary == Grid::Boundary::Truncate);
+	if (table.truncate)
+	{
+		table.edges = Bytecode::compile(ast, boundary);
+		if (!table.edges.error.empty())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void runOneStep(int16_t *oldgrid,
+                int16_t *newgrid,
+                Grid::Coordinate width,
+                Grid::Coordinate height,
+                Grid::Coordinate xStart,
+                Grid::Coordinate xEnd,
+                Grid::Coordinate yStart,
+                Grid::Coordinate yEnd,
+                const Table &table)
+{
+	// Unless neighbourhoods are truncated, the halo gives every cell eight
+	// neighbours.  Otherwise, the cells at the edges have fewer, so run the
+	// kernel for them and use the table for the rest.
+	Grid::Coordinate x0 = xStart, x1 = xEnd, y0 = yStart, y1 = yEnd;
+	if (table.truncate)
+	{
+		x0 = std::max<Grid::Coordinate>(xStart, 1);
+		x1 = std::min<Grid::Coordinate>(xEnd, width - 1);
+		y0 = std::max<Grid::Coordinate>(yStart, 1);
+		y1 = std::min<Grid::Coordinate>(yEnd, height - 1);
+		if ((x0 >= x1) || (y0 >= y1))
+		{
+			Bytecode::runOneStep(oldgrid, newgrid, width, height, xStart, xEnd,
+			                     yStart, yEnd, table.edges);
+			return;
+		}
+		auto edge = [&](Grid::Coordinate xs, Grid::Coordinate xe,
+		                Grid::Coordinate ys, Grid::Coordinate ye)
+		{
+			if ((xs < xe) && (ys < ye))
+			{
+				Bytecode::runOneStep(oldgrid, newgrid, width, height, xs, xe,
+				                     ys, ye, table.edges);
+			}
+		};
+		edge(xStart, x0, yStart, yEnd);
+		edge(x1, xEnd, yStart, yEnd);
+		edge(x0, x1, yStart, y0);
+		edge(x0, x1, y1, yEnd);
+	}
+	switch (table.states)
+	{
+		case 1:
+			runTable<1>(oldgrid, newgrid, height, x0, x1, y0, y1, table);
+			break;
+		case 2:
+			runTable<2>(oldgrid, newgrid, height, x0, x1, y0, y1, table);
+			break;
+		case 3:
+			runTable<3>(oldgrid, newgrid, height, x0, x1, y0, y1, table);
+			break;
+		case 4:
+			runTable<4>(oldgrid, newgrid, height, x0, x1, y0, y1, table);
+			break;
+	}
+}
+
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_NEIGHBOURHOOD_H_INCLUDED
+#define CELLATOM_NEIGHBOURHOOD_H_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include "bytecode.hh"
+#include "grid.hh"
+
+namespace AST
+{
+	struct StatementList;
+}
+
+/**
+ * An engine for kernels whose cells only ever hold a few values.  The new
+ * value of a cell is then a function of the values in its 3x3 neighbourhood,
+ * so it can be computed once for every possible neighbourhood and each
+ * generation becomes a table lookup per cell.
+ */
+namespace Neighbourhood
+{
+	/**
+	 * The new value of a cell for each neighbourhood, for a kernel whose
+	 * cells hold values in the range [0, states).
+	 */
+	struct Table
+	{
+		/** The number of values that a cell can hold */
+		int states = 0;
+		/**
+		 * Whether the new value depends only on the value of the cell and
+		 * the sum of its neighbours.  The table then has an entry for each
+		 * pair, rather than for each neighbourhood.
+		 */
+		bool totalistic = false;
+		/**
+		 * The new values.  For the cell at (x, y), the index has a digit (in
+		 * base `states`) for each cell in its neighbourhood.  The most
+		 * significant are the cells at y-1, then those at y and then those
+		 * at y+1, each in the order x-1, x, x+1.  For totalistic tables, the
+		 * index is the value of the cell times the number of possible sums
+		 * (8 * (states - 1) + 1), plus the sum of its neighbours.
+		 */
+		std::vector<uint8_t> entries;
+		/**
+		 * The kernel as bytecode, for the cells at the edges when
+		 * neighbourhoods are truncated.
+		 */
+		Bytecode::Program edges;
+		/** Whether neighbourhoods are truncated at the edges of the grid */
+		bool truncate = false;
+	};
+
+	/**
+	 * The largest number of entries in a table for every neighbourhood.  This
+	 * allows up to four values in each cell.
+	 */
+	const size_t MaxEntries = 1 << 18;
+
+	/**
+	 * Builds the table for a kernel, when every cell (and every neighbour
+	 * beyond the edges of the grid) starts in the range [0, initial].  This
+	 * runs the kernel on every possible neighbourhood, so it is exact: if it
+	 * returns true, then every value that the kernel computes is in the
+	 * table's range of states.  Returns false if the kernel's global
+	 * registers depend on the order of the cells, if the table would have
+	 * more than `MaxEntries` entries, or if the kernel can't be compiled to
+	 * bytecode.
+	 */
+	bool build(AST::StatementList *ast,
+	           int16_t initial,
+	           Grid::Boundary boundary,
+	           Table &table);
+
+	/**
+	 * Run the table for one step over the cells with x in [xStart, xEnd) and
+	 * y in [yStart, yEnd).  The halo must have been filled in unless
+	 * neighbourhoods are truncated.
+	 */
+	void runOneStep(int16_t *oldgrid,
+	                int16_t *newgrid,
+	                Grid::Coordinate width,
+	                Grid::Coordinate height,
+	                Grid::Coordinate xStart,
+	                Grid::Coordinate xEnd,
+	                Grid::Coordinate yStart,
+	                Grid::Coordinate yEnd,
+	                const Table &table);
+}
+
+#endif // CELLATOM_NEIGHBOURHOOD_H_INCLUDED
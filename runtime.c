@@ -1,15 +1,68 @@
 #include <stdint.h>
 
-// Prototype.  The real function will be inserted by the JIT.
-int16_t cell(int16_t *oldgrid, int16_t *newgrid, int16_t width, int16_t height, int16_t x, int16_t y, int16_t v, int16_t *g);
-
-void automaton(int16_t *oldgrid, int16_t *newgrid, int16_t width, int16_t
-    height) {
-  int16_t g[10] = {0};
-  int i=0;
-  for (int16_t x=0 ; x<width ; x++) {
-    for (int16_t y=0 ; y<height ; y++,i++) {
-      newgrid[i] = cell(oldgrid, newgrid, width, height, x, y, oldgrid[i], g);
+// Nonzero if the neighbourhoods of cells at the edges of the grid are
+// truncated, so those cells must use the bounds-checked kernel.  Otherwise,
+// the halo around the grid provides their neighbours and every cell can use
+// the other kernels.  The real (constant) value will be inserted by the JIT.
+extern const int16_t cell_truncate;
+
+// The kernels and the automaton loop are declared for 16-bit cells, and for
+// 8-bit cells (with an _i8 suffix) for programs whose values are known to
+// fit.  The JIT fills in the kernels for one of them and removes the other.
+#define CELL_T int16_t
+#define NAME(x) x
+#include "runtime.inc"
+#undef NAME
+#undef CELL_T
+
+#define CELL_T int8_t
+#define NAME(x) x##_i8
+#include "runtime.inc"
+#undef NAME
+#undef CELL_T
+
+// Ensembles of grids of the same size store the members' copies of each cell
+// next to each other (see grid.hh), so the ensemble kernels compute a cell in
+// several members at once, with the same instructions for every member.  The
+// global registers are interleaved in the same way, so that each member has
+// its own.
+
+// Prototype for the ensemble kernel, which computes the cell at (x, y) in
+// ensemble_lanes members, starting at member, and writes them to newgrid.  The
+// real function will be inserted by the JIT.
+void ensemble_vector(int16_t *oldgrid, int16_t *newgrid, int64_t width, int64_t height, int count, int64_t x, int64_t y, int member, int16_t *g);
+
+// Prototype for the version of the ensemble kernel that computes the cell in
+// one member, for the members left over when the ensemble isn't a multiple of
+// ensemble_lanes.  The real function will be inserted by the JIT.
+void ensemble_cell(int16_t *oldgrid, int16_t *newgrid, int64_t width, int64_t height, int count, int64_t x, int64_t y, int member, int16_t *g);
+
+// The number of members computed by each call to ensemble_vector, or 0 if the
+// target has no vector registers.  The real (constant) value will be inserted
+// by the JIT.
+extern const int16_t ensemble_lanes;
+
+// Runs one step of an ensemble of count grids over the cells with x in
+// [xStart, xEnd) and y in [yStart, yEnd) of every member.  The caller provides
+// room for the 10*count global registers in g, rather than putting an
+// arbitrarily large array on the stack.
+void ensemble(int16_t *oldgrid, int16_t *newgrid, int64_t width, int64_t
+    height, int count, int64_t xStart, int64_t xEnd, int64_t yStart, int64_t
+    yEnd, int16_t *g) {
+  for (int i=0 ; i<10*count ; i++) {
+    g[i] = 0;
+  }
+  for (int64_t x=xStart ; x<xEnd ; x++) {
+    for (int64_t y=yStart ; y<yEnd ; y++) {
+      int member = 0;
+      if (ensemble_lanes > 0) {
+        for ( ; member+ensemble_lanes<=count ; member+=ensemble_lanes) {
+          ensemble_vector(oldgrid, newgrid, width, height, count, x, y, member, g);
+        }
+      }
+      for ( ; member<count ; member++) {
+        ensemble_cell(oldgrid, newgrid, width, height, count, x, y, member, g);
+      }
     }
   }
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "schedule.hh"
+#include <algorithm>
+
+template<typename Cell>
+void runGenerations(Cell *&grid,
+                    Cell *&spare,
+                    int iterations,
+                    const Schedule &s,
+                    const typename BlockedGrid<Cell>::Kernel &automaton)
+{
+	if (s.blockSize > 0)
+	{
+		BlockedGrid<Cell> blocked(s.width, s.height, s.blockSize,
+		                          s.generationsPerBlock, s.boundary,
+		                          s.edgeValue, s.pool->size());
+		blocked.load(grid);
+		// The grid is only copied back out of the blocks when a snapshot is
+		// due, so runs of blocks stop there.
+		for (int i=0 ; i<iterations ; )
+		{
+			int generations = std::min<int>(s.generationsPerBlock,
+			                                iterations - i);
+			if (s.snapshots)
+			{
+				generations = std::min(generations, s.snapshots->untilNext());
+			}
+			blocked.step(*s.pool, automaton, generations);
+			i += generations;
+			if (s.snapshots && s.snapshots->advance(generations))
+			{
+				blocked.store(grid);
+				s.snapshots->take(grid);
+			}
+		}
+		blocked.store(grid);
+		return;
+	}
+	// Each thread in the pool owns a contiguous band of rows.
+	int threads = s.pool->size();
+	auto bandStart = [&](int band) {
+		return static_cast<Grid::Coordinate>(s.width * band / threads);
+	};
+	for (int i=0 ; i<iterations ; i++)
+	{
+		Grid::fillHalo(grid, s.width, s.height, s.boundary, s.edgeValue);
+		auto kernel = [&](Grid::Coordinate xStart, Grid::Coordinate xEnd,
+		                  Grid::Coordinate yStart, Grid::Coordinate yEnd) {
+			automaton(grid, spare, s.width, s.height,
+			          xStart, xEnd, yStart, yEnd);
+		};
+		if (s.tiles)
+		{
+			s.tiles->step(grid, spare, *s.pool, kernel);
+		}
+		else
+		{
+			s.pool->run([&](int band) {
+				kernel(bandStart(band), bandStart(band+1), 0, s.height);
+			});
+		}
+		std::swap(grid, spare);
+		if (s.snapshots && s.snapshots->advance(1))
+		{
+			s.snapshots->take(grid);
+		}
+	}
+}
+
+template void runGenerations<int16_t>(int16_t *&, int16_t *&, int,
+                                      const Schedule &,
+                                      const BlockedGrid<int16_t>::Kernel &);
+template void runGenerations<int8_t>(int8_t *&, int8_t *&, int,
+                                     const Schedule &,
+                                     const BlockedGrid<int8_t>::Kernel &);
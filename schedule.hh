@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_SCHEDULE_H_INCLUDED
+#define CELLATOM_SCHEDULE_H_INCLUDED
+#include <stdint.h>
+#include "blocks.hh"
+#include "grid.hh"
+#include "snapshot.hh"
+#include "threadpool.hh"
+#include "tiles.hh"
+
+/**
+ * How each generation is divided into pieces of work.
+ */
+struct Schedule
+{
+	/** The width of the grid */
+	Grid::Coordinate width;
+	/** The height of the grid */
+	Grid::Coordinate height;
+	/** How the neighbours of the cells at the edges are found */
+	Grid::Boundary boundary;
+	/** The value of neighbours beyond the edges for constant boundaries */
+	int16_t edgeValue;
+	/** The size of the blocks to store the grid in, or 0 for the normal layout */
+	int16_t blockSize;
+	/** The number of generations to compute for each block at a time */
+	int16_t generationsPerBlock;
+	/** The tracker for tiles that can't change, or null to compute them all */
+	ActiveTiles *tiles;
+	/** The threads to run on */
+	ThreadPool *pool;
+	/** The writer to pass snapshots of the grid to, or null for none */
+	SnapshotWriter *snapshots;
+};
+
+/**
+ * Runs `iterations` generations of `automaton`, leaving the result in `grid`.
+ * Unless the grid is stored in blocks, `spare` is used for the other
+ * generation and the two may be swapped.  The automaton is used for either the
+ * blocks, the tiles that may change, or each band of rows.  Whenever a
+ * snapshot is due, the grid is passed to the snapshot writer.
+ */
+template<typename Cell>
+void runGenerations(Cell *&grid,
+                    Cell *&spare,
+                    int iterations,
+                    const Schedule &s,
+                    const typename BlockedGrid<Cell>::Kernel &automaton);
+
+#endif
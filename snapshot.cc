@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "snapshot.hh"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include "grid.hh"
+#include "gridfile.hh"
+
+SnapshotWriter::SnapshotWriter(FILE *f,
+                               Grid::Coordinate w,
+                               Grid::Coordinate h,
+                               int generations,
+                               int buffers,
+                               uint64_t start)
+	: file(f), width(w), height(h), interval(generations),
+	  generation(start), frames(buffers),
+	  thread(&SnapshotWriter::writer, this)
+{
+	std::lock_guard<std::mutex> l(lock);
+	for (auto &frame : frames)
+	{
+		frame.cells.resize(static_cast<size_t>(width) * height);
+		available.push_back(&frame);
+	}
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	if (!finished)
+	{
+		finish();
+	}
+}
+
+bool SnapshotWriter::finish()
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		exiting = true;
+	}
+	changed.notify_all();
+	thread.join();
+	finished = true;
+	if ((fflush(file) != 0) && (writeError == 0))
+	{
+		writeError = errno;
+	}
+	return writeError == 0;
+}
+
+bool SnapshotWriter::advance(int generations)
+{
+	generation += generations;
+	sinceLast += generations;
+	if (sinceLast < interval)
+	{
+		return false;
+	}
+	sinceLast = 0;
+	return true;
+}
+
+template<typename Cell>
+void SnapshotWriter::take(const Cell *grid)
+{
+	Frame *frame;
+	{
+		std::unique_lock<std::mutex> l(lock);
+		if (available.empty())
+		{
+			auto start = std::chrono::steady_clock::now();
+			changed.wait(l, [&]() { return !available.empty(); });
+			std::chrono::duration<double> waited =
+				std::chrono::steady_clock::now() - start;
+			stalled += waited.count();
+		}
+		frame = available.back();
+		available.pop_back();
+	}
+	// Only the run fills in frames, so this doesn't need the lock.
+	frame->generation = generation;
+	int16_t *cells = frame->cells.data();
+	for (Grid::Coordinate x=0 ; x<width ; x++)
+	{
+		const Cell *row = &grid[Grid::index(height, x, 0)];
+		cells = std::copy(row, row + height, cells);
+	}
+	snapshots++;
+	{
+		std::lock_guard<std::mutex> l(lock);
+		queued.push_back(frame);
+	}
+	changed.notify_all();
+}
+
+void SnapshotWriter::writer()
+{
+	std::unique_lock<std::mutex> l(lock);
+	for (;;)
+	{
+		changed.wait(l, [&]() { return exiting || !queued.empty(); });
+		if (queued.empty())
+		{
+			return;
+		}
+		Frame *frame = queued.front();
+		queued.pop_front();
+		l.unlock();
+		write(*frame);
+		l.lock();
+		available.push_back(frame);
+		changed.notify_all();
+	}
+}
+
+void SnapshotWriter::write(const Frame &frame)
+{
+	// Once a write has failed, the file is no use, so don't waste time
+	// compressing the rest.
+	if (writeError != 0)
+	{
+		return;
+	}
+	// Grids that are worth taking snapshots of are mostly large areas of the
+	// same value, so even simple run-length encoding shrinks them a lot.
+	encoded.clear();
+	const std::vector<int16_t> &cells = frame.cells;
+	for (size_t i=0 ; i<cells.size() ; )
+	{
+		size_t run = 1;
+		while ((i + run < cells.size()) && (cells[i + run] == cells[i]) &&
+		       (run < UINT16_MAX))
+		{
+			run++;
+		}
+		encoded.push_back(static_cast<uint16_t>(run));
+		encoded.push_back(static_cast<uint16_t>(cells[i]));
+		i += run;
+	}
+	GridFile::Header header;
+	GridFile::initialise(header, width, height, GridFile::RunLength);
+	header.generation = frame.generation;
+	errno = 0;
+	if ((fwrite(&header, sizeof(header), 1, file) != 1) ||
+	    (fwrite(encoded.data(), sizeof(uint16_t), encoded.size(), file) !=
+	     encoded.size()))
+	{
+		// Some C libraries don't set errno for short writes.
+		writeError = (errno != 0) ? errno : EIO;
+	}
+}
+
+template void SnapshotWriter::take(const int16_t *);
+template void SnapshotWriter::take(const int8_t *);
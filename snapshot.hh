@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_SNAPSHOT_H_INCLUDED
+#define CELLATOM_SNAPSHOT_H_INCLUDED
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "grid.hh"
+
+/**
+ * Writes a snapshot of the grid every few generations without stopping the
+ * run for longer than it takes to copy the grid.  Each snapshot is copied into
+ * one of a fixed set of frame buffers, which are reused, and a background
+ * thread compresses it and appends it to the output file.  If the writer
+ * falls behind and every buffer is waiting to be written, then the run waits
+ * for one to be freed, and the time spent waiting is recorded.
+ *
+ * The file is a sequence of frames, each of which is a grid file header (see
+ * gridfile.hh) with the generation of the snapshot, followed by the cells,
+ * run-length encoded.
+ */
+class SnapshotWriter
+{
+	public:
+	/**
+	 * Construct a writer that appends a snapshot of a `width` by `height`
+	 * grid to `file` every `interval` generations, using `buffers` frame
+	 * buffers.  `generation` is the number of generations that the grid has
+	 * already been run for.
+	 */
+	SnapshotWriter(FILE *file,
+	               Grid::Coordinate width,
+	               Grid::Coordinate height,
+	               int interval,
+	               int buffers,
+	               uint64_t generation);
+	/**
+	 * Destroy the writer, waiting for all of the queued snapshots to be
+	 * written if `finish` hasn't already done so.
+	 */
+	~SnapshotWriter();
+	/**
+	 * Waits for all of the queued snapshots to be written and flushes the
+	 * file.  Returns false if any of them couldn't be written, in which case
+	 * `error` gives the reason.  No more snapshots may be taken after this.
+	 */
+	bool finish();
+	/**
+	 * The `errno` value for the first write that failed, or 0 if none has.
+	 * This is only valid after `finish` has been called.
+	 */
+	int error() const
+	{
+		return writeError;
+	}
+	/**
+	 * Returns the number of generations until the next snapshot is due.
+	 */
+	int untilNext() const
+	{
+		return interval - sinceLast;
+	}
+	/**
+	 * Records that `generations` more generations have been run.  Returns true
+	 * if a snapshot is now due, in which case the caller must pass the grid
+	 * to `take`.  The count must not go past the next snapshot.
+	 */
+	bool advance(int generations);
+	/**
+	 * Queues a snapshot of a grid in the normal layout (see grid.hh), with
+	 * either 16-bit or 8-bit cells.  This waits if every frame buffer is
+	 * still waiting to be written.
+	 */
+	template<typename Cell>
+	void take(const Cell *grid);
+	/**
+	 * The number of snapshots taken so far.
+	 */
+	int taken() const
+	{
+		return snapshots;
+	}
+	/**
+	 * The total time, in seconds, that `take` has spent waiting for a frame
+	 * buffer to be freed.
+	 */
+	double stalledSeconds() const
+	{
+		return stalled;
+	}
+	private:
+	/**
+	 * A snapshot waiting to be written.
+	 */
+	struct Frame
+	{
+		/** The generation that the snapshot was taken at */
+		uint64_t generation;
+		/** The cells, without the halo, in x-major order */
+		std::vector<int16_t> cells;
+	};
+	/**
+	 * The body of the writer thread.  Writes frames until the writer is
+	 * destroyed and the queue is empty.
+	 */
+	void writer();
+	/**
+	 * Compresses a frame and appends it to the file.
+	 */
+	void write(const Frame &frame);
+	/** The file that the snapshots are written to */
+	FILE *file;
+	/** The width of the grid */
+	Grid::Coordinate width;
+	/** The height of the grid */
+	Grid::Coordinate height;
+	/** The number of generations between snapshots */
+	int interval;
+	/** The number of generations since the last snapshot */
+	int sinceLast = 0;
+	/** The generation that the grid has reached */
+	uint64_t generation;
+	/** The number of snapshots taken */
+	int snapshots = 0;
+	/** The time spent waiting for frame buffers, in seconds */
+	double stalled = 0;
+	/** Every frame buffer */
+	std::vector<Frame> frames;
+	/** The run-length encoded cells of the frame being written */
+	std::vector<uint16_t> encoded;
+	/**
+	 * The `errno` value for the first write that failed, or 0.  This is only
+	 * modified by the writer thread, which stops writing once it is set.
+	 */
+	int writeError = 0;
+	/** Set when `finish` has joined the writer thread */
+	bool finished = false;
+	/**
+	 * Lock protecting all of the fields below.
+	 */
+	std::mutex lock;
+	/**
+	 * Condition variable used to wake the writer when a frame is queued, or
+	 * the run when a frame is freed.
+	 */
+	std::condition_variable changed;
+	/** The frames that are free to be filled in */
+	std::vector<Frame*> available;
+	/** The frames waiting to be written, oldest first */
+	std::deque<Frame*> queued;
+	/** Set when the writer is being destroyed */
+	bool exiting = false;
+	/**
+	 * The background thread.  This is declared last so that everything that
+	 * it uses is constructed before it starts.
+	 */
+	std::thread thread;
+};
+
+#endif // CELLATOM_SNAPSHOT_H_INCLUDED
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "threadpool.hh"
+
+ThreadPool::ThreadPool(int threads)
+{
+	for (int i=1 ; i<threads ; i++)
+	{
+		workers.emplace_back(&ThreadPool::worker, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		exiting = true;
+	}
+	started.notify_all();
+	for (auto &t : workers)
+	{
+		t.join();
+	}
+}
+
+void ThreadPool::run(const std::function<void(int)> &j)
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		job = &j;
+		pending = workers.size();
+		generation++;
+	}
+	started.notify_all();
+	// The calling thread does its share of the work rather than sitting idle.
+	j(0);
+	// This is the only barrier: wait for every worker to finish.
+	std::unique_lock<std::mutex> l(lock);
+	finished.wait(l, [&]() { return pending == 0; });
+}
+
+void ThreadPool::worker(int index)
+{
+	unsigned seen = 0;
+	std::unique_lock<std::mutex> l(lock);
+	for (;;)
+	{
+		started.wait(l, [&]() { return exiting || (generation != seen); });
+		if (exiting)
+		{
+			return;
+		}
+		seen = generation;
+		const std::function<void(int)> *j = job;
+		l.unlock();
+		(*j)(index);
+		l.lock();
+		if (--pending == 0)
+		{
+			finished.notify_one();
+		}
+	}
+}
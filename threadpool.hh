@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_THREADPOOL_H_INCLUDED
+#define CELLATOM_THREADPOOL_H_INCLUDED
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A persistent pool of worker threads.  The threads are created once and then
+ * reused for every generation, so the only per-generation synchronisation cost
+ * is a single barrier at the end of `run()`.
+ */
+class ThreadPool
+{
+	public:
+	/**
+	 * Construct a pool that runs jobs on `threads` threads.  The calling
+	 * thread counts as one of these, so a pool of size one creates no new
+	 * threads.
+	 */
+	ThreadPool(int threads);
+	/**
+	 * Destroy the pool, waiting for all of the worker threads to exit.
+	 */
+	~ThreadPool();
+	/**
+	 * The number of threads (including the caller) that run each job.
+	 */
+	int size() const { return workers.size() + 1; }
+	/**
+	 * Run `job(i)` once for every `i` in the range [0, size()).  The calling
+	 * thread runs `job(0)`.  This returns once every thread has finished.
+	 */
+	void run(const std::function<void(int)> &job);
+	private:
+	/**
+	 * The body of each worker thread.  Waits for a new job, runs it, and
+	 * reports completion.
+	 */
+	void worker(int index);
+	/**
+	 * The worker threads.
+	 */
+	std::vector<std::thread> workers;
+	/**
+	 * Lock protecting all of the fields below.
+	 */
+	std::mutex lock;
+	/**
+	 * Condition variable used to wake the workers when a new job is ready.
+	 */
+	std::condition_variable started;
+	/**
+	 * Condition variable used to wake the caller when the last worker
+	 * finishes.
+	 */
+	std::condition_variable finished;
+	/**
+	 * The job currently being run.
+	 */
+	const std::function<void(int)> *job = nullptr;
+	/**
+	 * Counter incremented for each new job, so that workers can tell a new
+	 * job from a spurious wakeup.
+	 */
+	unsigned generation = 0;
+	/**
+	 * The number of workers that have not yet finished the current job.
+	 */
+	int pending = 0;
+	/**
+	 * Set when the pool is being destroyed.
+	 */
+	bool exiting = false;
+};
+
+#endif // CELLATOM_THREADPOOL_H_INCLUDED
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "tiles.hh"
+#include <algorithm>
+#include <string.h>
+
+ActiveTiles::ActiveTiles(Grid::Coordinate w, Grid::Coordinate h, int16_t size,
+                         Grid::Boundary boundary)
+	: width(w), height(h), tileSize(size),
+	  tilesX((w + size - 1) / size), tilesY((h + size - 1) / size),
+	  wrap(boundary == Grid::Boundary::Wrap),
+	  changed(tilesX * tilesY, 1), nextChanged(tilesX * tilesY, 0)
+{
+}
+
+bool ActiveTiles::mayChange(int tx, int ty)
+{
+	for (int x = tx - 1 ; x <= tx + 1 ; x++)
+	{
+		for (int y = ty - 1 ; y <= ty + 1 ; y++)
+		{
+			int nx = x;
+			int ny = y;
+			// With wrapped edges, the tiles on opposite edges are neighbours.
+			// Otherwise, there is nothing beyond the edge that can change.
+			if (wrap)
+			{
+				nx = (x + tilesX) % tilesX;
+				ny = (y + tilesY) % tilesY;
+			}
+			else if (x < 0 || x >= tilesX || y < 0 || y >= tilesY)
+			{
+				continue;
+			}
+			if (changed[nx * tilesY + ny])
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+template<typename Cell>
+void ActiveTiles::step(const Cell *oldgrid,
+                       const Cell *newgrid,
+                       ThreadPool &pool,
+                       const Kernel &kernel)
+{
+	active.clear();
+	for (int tx=0 ; tx<tilesX ; tx++)
+	{
+		for (int ty=0 ; ty<tilesY ; ty++)
+		{
+			int tile = tx * tilesY + ty;
+			nextChanged[tile] = 0;
+			if (mayChange(tx, ty))
+			{
+				active.push_back(tile);
+			}
+		}
+	}
+	// Each thread takes a contiguous range of the active tiles.  As well as
+	// running the kernel, it checks whether the tile changed, so that the
+	// comparison is done while the tile is still in the cache.
+	int threads = pool.size();
+	pool.run([&](int band) {
+		size_t end = active.size() * (band + 1) / threads;
+		for (size_t i = active.size() * band / threads ; i<end ; i++)
+		{
+			int tile = active[i];
+			Grid::Coordinate xStart = Grid::Coordinate(tile / tilesY) * tileSize;
+			Grid::Coordinate yStart = Grid::Coordinate(tile % tilesY) * tileSize;
+			Grid::Coordinate xEnd = std::min(xStart + tileSize, width);
+			Grid::Coordinate yEnd = std::min(yStart + tileSize, height);
+			kernel(xStart, xEnd, yStart, yEnd);
+			size_t rowSize = (yEnd - yStart) * sizeof(Cell);
+			for (Grid::Coordinate x=xStart ; x<xEnd ; x++)
+			{
+				Grid::Coordinate start = Grid::index(height, x, yStart);
+				if (memcmp(oldgrid + start, newgrid + start, rowSize) != 0)
+				{
+					nextChanged[tile] = 1;
+					break;
+				}
+			}
+		}
+	});
+	std::swap(changed, nextChanged);
+}
+
+template void ActiveTiles::step(const int16_t *, const int16_t *,
+                                ThreadPool &, const Kernel &);
+template void ActiveTiles::step(const int8_t *, const int8_t *,
+                                ThreadPool &, const Kernel &);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2014 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CELLATOM_TILES_H_INCLUDED
+#define CELLATOM_TILES_H_INCLUDED
+#include <functional>
+#include <stdint.h>
+#include <vector>
+#include "grid.hh"
+#include "threadpool.hh"
+
+/**
+ * Tracks which parts of a grid are changing, so that the parts that can't
+ * change are not recomputed.  The grid is divided into square tiles.  If
+ * neither a tile nor any of the tiles around it changed in the last
+ * generation, then (as long as the kernel depends only on the neighbourhood of
+ * each cell) the tile won't change in the next generation either.  The grids
+ * are double buffered, so the new grid already contains the same values as the
+ * old one for that tile, and it can be skipped entirely.
+ *
+ * This is only valid for kernels whose global registers don't depend on the
+ * order of the cells.
+ */
+class ActiveTiles
+{
+	public:
+	/**
+	 * A function that runs one generation for the cells with x in [xStart,
+	 * xEnd) and y in [yStart, yEnd).
+	 */
+	typedef std::function<void(Grid::Coordinate xStart,
+	                           Grid::Coordinate xEnd,
+	                           Grid::Coordinate yStart,
+	                           Grid::Coordinate yEnd)> Kernel;
+	/**
+	 * Construct a tracker for a grid, using tiles of `tileSize` by
+	 * `tileSize` cells.  Every tile is considered to have changed before the
+	 * first generation.
+	 */
+	ActiveTiles(Grid::Coordinate width,
+	            Grid::Coordinate height,
+	            int16_t tileSize,
+	            Grid::Boundary boundary);
+	/**
+	 * Run one generation, from `oldgrid` to `newgrid`, using `kernel` for the
+	 * tiles that may change.  The active tiles are divided between the
+	 * threads in the pool.  Grids may have either 16-bit or 8-bit cells.
+	 */
+	template<typename Cell>
+	void step(const Cell *oldgrid,
+	          const Cell *newgrid,
+	          ThreadPool &pool,
+	          const Kernel &kernel);
+	/**
+	 * The number of tiles that were computed in the last generation.
+	 */
+	size_t activeCount() const { return active.size(); }
+	private:
+	/**
+	 * Returns true if tile (tx, ty) or any of the tiles around it changed
+	 * in the last generation.
+	 */
+	bool mayChange(int tx, int ty);
+	/** The width of the grid */
+	Grid::Coordinate width;
+	/** The height of the grid */
+	Grid::Coordinate height;
+	/** The length of the sides of each tile */
+	int16_t tileSize;
+	/** The number of tiles in the x direction */
+	int tilesX;
+	/** The number of tiles in the y direction */
+	int tilesY;
+	/** Whether the tiles at each edge are next to those at the opposite edge */
+	bool wrap;
+	/**
+	 * Which tiles changed in the last generation, indexed by x tile and then
+	 * y tile.  Bytes rather than bits, so that different threads can update
+	 * adjacent tiles.
+	 */
+	std::vector<uint8_t> changed;
+	/** Which tiles changed in the generation being computed */
+	std::vector<uint8_t> nextChanged;
+	/** The tiles that are being computed in this generation */
+	std::vector<int> active;
+};
+
+#endif // CELLATOM_TILES_H_INCLUDED